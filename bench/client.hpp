@@ -0,0 +1,120 @@
+#ifndef MQTT_BENCH_CLIENT_H_
+#define MQTT_BENCH_CLIENT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+using namespace boost;
+using asio::ip::tcp;
+
+namespace bench {
+
+	// Minimal blocking MQTT 3.1.1 client used by the benchmarks
+	class Client {
+	public:
+		explicit Client(asio::io_context& io) : sock_(io) {}
+
+		void Open(const std::string& host, uint16_t port) {
+			sock_.connect({ asio::ip::make_address(host), port });
+			sock_.set_option(tcp::no_delay(true));
+		}
+
+		// Sends CONNECT and waits for CONNACK
+		void Connect(const std::string& client_id, bool clean_session = true, uint16_t keepalive = 600) {
+			std::vector<uint8_t> body{ 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04 };
+			body.push_back(clean_session ? 0x02 : 0x00);
+			body.push_back(uint8_t(keepalive >> 8u));
+			body.push_back(uint8_t(keepalive));
+			AppendString(body, client_id);
+
+			Send(0x10, body);
+			ReadPacket();
+		}
+
+		void Subscribe(const std::string& topic, uint8_t qos, uint16_t pkt_id = 1) {
+			std::vector<uint8_t> body{ uint8_t(pkt_id >> 8u), uint8_t(pkt_id) };
+			AppendString(body, topic);
+			body.push_back(qos);
+
+			Send(0x82, body);
+			ReadPacket();
+		}
+
+		void Publish(const std::string& topic, const std::string& payload, uint8_t qos = 0, uint16_t pkt_id = 1) {
+			std::vector<uint8_t> body;
+			AppendString(body, topic);
+
+			if (qos > 0) {
+				body.push_back(uint8_t(pkt_id >> 8u));
+				body.push_back(uint8_t(pkt_id));
+			}
+			body.insert(end(body), begin(payload), end(payload));
+
+			Send(0x30 | (qos << 1u), body);
+		}
+
+		void Disconnect() {
+			Send(0xE0, {});
+		}
+
+		// Reads one packet, returns the first byte of the fixed header
+		uint8_t ReadPacket(std::vector<uint8_t>* body = nullptr) {
+			uint8_t first = 0;
+			asio::read(sock_, asio::buffer(&first, 1));
+
+			size_t len = 0;
+			size_t multiplier = 1;
+			uint8_t byte = 0;
+
+			do {
+				asio::read(sock_, asio::buffer(&byte, 1));
+				len += (byte & 127) * multiplier;
+				multiplier *= 128;
+			} while ((byte & 128) != 0);
+
+			std::vector<uint8_t> tmp(len);
+			asio::read(sock_, asio::buffer(tmp));
+
+			if (body) {
+				*body = std::move(tmp);
+			}
+			return first;
+		}
+
+		void Send(uint8_t first, const std::vector<uint8_t>& body) {
+			std::vector<uint8_t> pkt{ first };
+			size_t len = body.size();
+
+			do {
+				uint8_t d = len % 128;
+				len /= 128;
+				if (len > 0)
+					d |= 128;
+				pkt.push_back(d);
+			} while (len > 0);
+
+			pkt.insert(end(pkt), begin(body), end(body));
+			asio::write(sock_, asio::buffer(pkt));
+		}
+
+		tcp::socket& Socket() { return sock_; }
+
+	private:
+		static void AppendString(std::vector<uint8_t>& buf, const std::string& str) {
+			buf.push_back(uint8_t(str.size() >> 8u));
+			buf.push_back(uint8_t(str.size()));
+			buf.insert(end(buf), begin(str), end(str));
+		}
+
+		tcp::socket sock_;
+	};
+
+} // namespace bench
+
+#endif
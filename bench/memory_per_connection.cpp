@@ -0,0 +1,81 @@
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <string>
+#include <thread>
+
+#include "client.hpp"
+
+/*
+*  Opens N connections to a running server and reports how much
+*  resident memory the server process gained per connection.
+*
+*    ./bench_memory -s server_pid -n connections -p port -h host
+*/
+
+// Resident set size of the process in kilobytes (Linux only)
+static long ReadRss(const std::string& pid) {
+	std::ifstream status{ "/proc/" + pid + "/status" };
+	std::string key;
+
+	while (status >> key) {
+		if (key == "VmRSS:") {
+			long kb = 0;
+			status >> kb;
+			return kb;
+		}
+		status.ignore(4096, '\n');
+	}
+	return -1;
+}
+
+int main(int argc, char* argv[]) {
+
+	std::string host = "127.0.0.1";
+	std::string pid;
+	uint16_t port = 1883;
+	size_t connections = 1000;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+
+		if (arg == "-h")
+			host = argv[i + 1];
+		else if (arg == "-p")
+			port = std::atoi(argv[i + 1]);
+		else if (arg == "-n")
+			connections = std::atol(argv[i + 1]);
+		else if (arg == "-s")
+			pid = argv[i + 1];
+	}
+
+	if (pid.empty()) {
+		std::cerr << "usage: bench_memory -s server_pid [-n connections] [-p port] [-h host]\n";
+		return -1;
+	}
+
+	asio::io_context io;
+	std::list<bench::Client> clients;
+
+	long rss_before = ReadRss(pid);
+
+	for (size_t i = 0; i < connections; i++) {
+		clients.emplace_back(io);
+		clients.back().Open(host, port);
+		clients.back().Connect("bench-memory-" + std::to_string(i));
+	}
+
+	// let the server settle after the last CONNACK
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	long rss_after = ReadRss(pid);
+
+	for (auto& client : clients) {
+		client.Disconnect();
+	}
+
+	std::cout << "connections:      " << connections << '\n'
+			  << "rss before (KiB): " << rss_before << '\n'
+			  << "rss after (KiB):  " << rss_after << '\n'
+			  << "per connection:   " << double(rss_after - rss_before) * 1024 / connections << " bytes\n";
+}
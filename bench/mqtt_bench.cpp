@@ -0,0 +1,832 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "../network/server.hpp"
+#include "../utility/frame_decoder.hpp"
+#include "../utility/histogram.hpp"
+#include "../utility/mqtt.hpp"
+
+/*
+*  Load generator of the broker. Every client is a coroutine on one of the -T threads,
+*  publishers put the time of sending into the first 8 bytes of the payload and subscribers
+*  record the end-to-end latency into HDR histograms of their thread.
+*
+*    ./mqtt_bench -s scenario [-P publishers] [-S subscribers] [-q qos] [-b payload] [-r rate]
+*                 [-d seconds] [-i inflight] [-c connections] [-k parallel] [-T threads]
+*                 [-e broker_threads [-cr connects_per_second] | -h host -p port]
+*
+*  Scenarios:
+*    fanout   - every publisher sends to one topic, every subscriber subscribes to it
+*    fanin    - every publisher has its own topic, subscribers take all of them with '+'
+*    pairs    - publisher i sends to topic i, subscriber j subscribes to topic j % P
+*    wildcard - publishers send to topic/i/data, subscribers take it with '+' and '#' filters
+*    storm    - -c clients connect, -k at a time, the CONNACK latency is measured
+*    teardown - -c clients subscribe to a topic of all of them and one of their own, then all
+*               connections drop at once. The time until the broker has removed every
+*               subscription is measured, so it needs -e
+*    readmit  - -c clients with persistent sessions subscribe to a topic of their own, all connections
+*               drop at once and every client connects again, -k at a time. The time until all
+*               sessions are back is measured, with -cr the broker admits no more CONNECT per second
+*
+*  -r is the rate of every publisher in messages per second, 0 sends as fast as the broker takes them.
+*  With a rate the latency is measured from the time a message was due, so a stalled broker
+*  is not hidden by the publisher waiting for it. -e runs the broker in this process on a free port.
+*/
+
+using namespace boost;
+using asio::ip::tcp;
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	// relative error below 0.8%
+	typedef stats::Histogram<7> Histogram;
+
+	struct Options {
+		std::string scenario = "fanout";
+		std::string host = "127.0.0.1";
+		uint16_t port = 1883;
+		size_t publishers = 1;
+		size_t subscribers = 10;
+		uint8_t qos = 0;
+		size_t payload = 64;
+		size_t rate = 0;
+		size_t seconds = 10;
+		size_t inflight = 16;
+		size_t connections = 10000;
+		size_t parallel = 100;
+		size_t threads = 1;
+		size_t broker_threads = 0;
+		double connect_rate = 0; // of the broker of -e
+		bool clean = true;       // clean session of CONNECT
+	};
+
+	// Counters and latencies of one thread of the generator, the counters are read by main while it runs
+	struct alignas(64) ThreadStats {
+		std::atomic<uint64_t> sent{ 0 };
+		std::atomic<uint64_t> received{ 0 };
+		std::atomic<uint64_t> connected{ 0 };
+		std::atomic<uint64_t> failed{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };  // connections closed by the broker
+		std::atomic<uint64_t> finished{ 0 }; // connections closed after DISCONNECT
+		Histogram latency;
+	};
+
+	uint64_t Now() {
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+	}
+
+	void AppendLength(std::vector<uint8_t>& out, size_t len) {
+		uint8_t buf[MAX_LENGTH_BYTES];
+		int bytes = mqtt::EncodeLength(buf, len);
+		out.insert(out.end(), buf, buf + bytes);
+	}
+
+	void AppendString(std::vector<uint8_t>& out, std::string_view str) {
+		out.push_back(uint8_t(str.size() >> 8u));
+		out.push_back(uint8_t(str.size()));
+		out.insert(out.end(), str.begin(), str.end());
+	}
+
+	/*
+	*  Client of the generator. The packets are gathered in out_ and written by one writer coroutine,
+	*  the reader coroutine answers the acks and the PUBLISH of the broker as they come
+	*/
+	class Client {
+	public:
+		Client(asio::io_context& io, ThreadStats& stats, const Options& options)
+			: sock_(io), signal_(io), ready_(io), stats_(stats), options_(options) {
+			signal_.expires_at(Clock::time_point::max());
+			ready_.expires_at(Clock::time_point::max());
+		}
+
+		// Connects and waits for CONNACK, then for the SUBACK of the filters if there are any
+		asio::awaitable<bool> Open(const tcp::endpoint& endpoint, const std::string& client_id, const std::vector<std::string>& filters) {
+			system::error_code ec;
+			co_await sock_.async_connect(endpoint, asio::redirect_error(asio::use_awaitable, ec));
+
+			if (ec) {
+				co_return false;
+			}
+			sock_.set_option(tcp::no_delay(true), ec);
+
+			uint8_t flags = options_.clean ? 0x02 : 0x00;
+			std::vector<uint8_t> body{ 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, flags, 0x02, 0x58 };
+			AppendString(body, client_id);
+			Send(0x10, body);
+
+			if (!filters.empty()) {
+				body = { 0x00, 0x01 };
+
+				for (const std::string& filter : filters) {
+					AppendString(body, filter);
+					body.push_back(options_.qos);
+				}
+				Send(0x82, body);
+			}
+
+			asio::co_spawn(sock_.get_executor(), Write(), asio::detached);
+
+			// the reader returns after the last answer of the setup and is started again by Start
+			expected_ = filters.empty() ? 1 : 2;
+			connected_ = co_await Read();
+			co_return connected_.load();
+		}
+
+		bool Connected() const { return connected_.load(); }
+
+		void Start() {
+			expected_ = 0;
+			asio::co_spawn(sock_.get_executor(), Read(), asio::detached);
+		}
+
+		// Sends DISCONNECT, the broker closes the connection after it
+		void Disconnect() {
+			closing_ = true;
+			Send(0xE0, {});
+		}
+
+		asio::any_io_executor Executor() { return sock_.get_executor(); }
+
+		void Close() {
+			system::error_code ec;
+			sock_.close(ec);
+			signal_.cancel();
+			ready_.cancel();
+		}
+
+		// Sends PUBLISH until the deadline, at the rate of the options if there is one
+		asio::awaitable<void> Publish(std::string topic, Clock::time_point deadline) {
+			asio::steady_timer timer{ sock_.get_executor() };
+			auto interval = options_.rate > 0 ? std::chrono::nanoseconds(1'000'000'000 / options_.rate) : std::chrono::nanoseconds(0);
+			Clock::time_point due = Clock::now();
+			uint16_t pkt_id = 0;
+
+			while (sock_.is_open() && Clock::now() < deadline) {
+				if (options_.rate > 0) {
+					due += interval;
+					timer.expires_at(due);
+					co_await timer.async_wait(asio::use_awaitable);
+				}
+
+				// the broker takes no more than the window of QoS 1 and 2 and what the socket accepts
+				while (sock_.is_open() && (inflight_ >= options_.inflight || out_.size() > kMaxPending)) {
+					system::error_code ec;
+					co_await ready_.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				}
+
+				uint64_t stamp = options_.rate > 0 ? uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(due.time_since_epoch()).count()) : Now();
+				size_t len = 2 + topic.size() + (options_.qos > 0 ? 2 : 0) + options_.payload;
+
+				out_.push_back(uint8_t(PUBLISH_BYTE | (options_.qos << 1u)));
+				AppendLength(out_, len);
+				AppendString(out_, topic);
+
+				if (options_.qos > 0) {
+					pkt_id = pkt_id == 65535 ? 1 : pkt_id + 1;
+					out_.push_back(uint8_t(pkt_id >> 8u));
+					out_.push_back(uint8_t(pkt_id));
+					inflight_++;
+				}
+
+				size_t start = out_.size();
+				out_.resize(start + options_.payload);
+				std::memcpy(out_.data() + start, &stamp, sizeof(stamp));
+
+				sent_.fetch_add(1, std::memory_order_relaxed);
+				stats_.sent.fetch_add(1, std::memory_order_relaxed);
+				signal_.cancel_one();
+			}
+		}
+
+		uint64_t Sent() const { return sent_.load(std::memory_order_relaxed); }
+
+	private:
+		static constexpr size_t kMaxPending = 256 * 1024;
+
+		void Send(uint8_t first, const std::vector<uint8_t>& body) {
+			out_.push_back(first);
+			AppendLength(out_, body.size());
+			out_.insert(out_.end(), body.begin(), body.end());
+			signal_.cancel_one();
+		}
+
+		void SendAck(uint8_t first, uint16_t pkt_id) {
+			Send(first, { uint8_t(pkt_id >> 8u), uint8_t(pkt_id) });
+		}
+
+		asio::awaitable<void> Write() {
+			std::vector<uint8_t> writing;
+
+			while (sock_.is_open()) {
+				if (out_.empty()) {
+					system::error_code ec;
+					co_await signal_.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+					continue;
+				}
+
+				writing.swap(out_);
+
+				system::error_code ec;
+				co_await asio::async_write(sock_, asio::buffer(writing), asio::redirect_error(asio::use_awaitable, ec));
+
+				if (ec) {
+					break;
+				}
+				writing.clear();
+				ready_.cancel();
+			}
+		}
+
+		// Handles the packets of the broker, returns after expected_ answers if it is not 0
+		asio::awaitable<bool> Read() {
+			mqtt::FrameDecoder decoder;
+
+			for (;;) {
+				while (decoder.Parse(buf_.data() + begin_, end_ - begin_) == mqtt::FrameDecoder::kFrame) {
+					const uint8_t* frame = buf_.data() + begin_;
+					Handle(frame, decoder.FrameSize());
+
+					begin_ += decoder.FrameSize();
+					decoder.Reset();
+
+					if (expected_ > 0 && --expected_ == 0) {
+						co_return true;
+					}
+				}
+
+				std::memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+				end_ -= begin_;
+				begin_ = 0;
+
+				size_t needed = std::max(decoder.Needed(), end_ + 1024);
+				if (buf_.size() < needed) {
+					buf_.resize(std::max(needed, buf_.size() * 2));
+				}
+
+				system::error_code ec;
+				size_t n = co_await sock_.async_read_some(asio::buffer(buf_.data() + end_, buf_.size() - end_),
+					asio::redirect_error(asio::use_awaitable, ec));
+
+				if (ec) {
+					(closing_ ? stats_.finished : stats_.dropped).fetch_add(1, std::memory_order_relaxed);
+					Close();
+					co_return false;
+				}
+				end_ += n;
+			}
+		}
+
+		void Handle(const uint8_t* frame, size_t size) {
+			switch (frame[0] >> 4u) {
+			case PUBLISH: {
+				mqtt::PublishView pub;
+				if (mqtt::UnpackPublish(frame, size, &pub) != mqtt::kDecoded) {
+					break;
+				}
+
+				uint64_t stamp = 0;
+				if (pub.payload.size() >= sizeof(stamp)) {
+					std::memcpy(&stamp, pub.payload.data(), sizeof(stamp));
+					uint64_t now = Now();
+					stats_.latency.Record(now - std::min(stamp, now));
+				}
+				stats_.received.fetch_add(1, std::memory_order_relaxed);
+
+				uint8_t qos = (pub.header.bits >> 1u) & 3u;
+				if (qos == 1) {
+					SendAck(PUBACK_BYTE, pub.pkt_id);
+				}
+				else if (qos == 2) {
+					SendAck(PUBREC_BYTE, pub.pkt_id);
+				}
+				break;
+			}
+			case PUBREC:
+				SendAck(PUBREL_BYTE, uint16_t((frame[2] << 8u) | frame[3]));
+				break;
+			case PUBREL:
+				SendAck(PUBCOMP_BYTE, uint16_t((frame[2] << 8u) | frame[3]));
+				break;
+			case PUBACK:
+			case PUBCOMP:
+				inflight_--;
+				ready_.cancel();
+				break;
+			}
+		}
+
+		tcp::socket sock_;
+		asio::steady_timer signal_; // wakes the writer
+		asio::steady_timer ready_;  // wakes the publisher when the window or the socket has room
+		ThreadStats& stats_;
+		const Options& options_;
+
+		std::vector<uint8_t> out_;
+		std::vector<uint8_t> buf_ = std::vector<uint8_t>(4096);
+		size_t begin_ = 0;
+		size_t end_ = 0;
+		size_t expected_ = 0;
+		size_t inflight_ = 0;
+		bool closing_ = false;
+		std::atomic<bool> connected_{ false };
+		std::atomic<uint64_t> sent_{ 0 };
+	};
+
+	// Threads of the generator, each with its own io_context and statistics
+	class Workers {
+	public:
+		explicit Workers(size_t threads) : contexts_(threads), stats_(threads) {
+			for (auto& io : contexts_) {
+				threads_.emplace_back([&io] {
+					auto work = asio::make_work_guard(io);
+					io.run();
+				});
+			}
+		}
+
+		~Workers() {
+			Stop();
+		}
+
+		size_t Size() const { return contexts_.size(); }
+		asio::io_context& Context(size_t i) { return contexts_[i % contexts_.size()]; }
+		ThreadStats& Stats(size_t i) { return stats_[i % stats_.size()]; }
+
+		template<class F>
+		void Run(size_t i, F&& coroutine) {
+			asio::co_spawn(Context(i), std::forward<F>(coroutine), asio::detached);
+		}
+
+		uint64_t Sum(std::atomic<uint64_t> ThreadStats::* counter) {
+			uint64_t sum = 0;
+			for (auto& stats : stats_) {
+				sum += (stats.*counter).load(std::memory_order_relaxed);
+			}
+			return sum;
+		}
+
+		// The histograms are merged after the threads are stopped
+		Histogram Latency() {
+			Histogram all;
+			for (auto& stats : stats_) {
+				all.Merge(stats.latency);
+			}
+			return all;
+		}
+
+		void Stop() {
+			for (auto& io : contexts_) {
+				io.stop();
+			}
+			for (auto& th : threads_) {
+				if (th.joinable()) {
+					th.join();
+				}
+			}
+		}
+
+	private:
+		std::vector<asio::io_context> contexts_;
+		std::vector<ThreadStats> stats_;
+		std::vector<std::thread> threads_;
+	};
+
+	// Waits until the predicate holds or the timeout passes
+	template<class F>
+	bool WaitFor(F&& done, std::chrono::milliseconds timeout) {
+		auto deadline = Clock::now() + timeout;
+
+		while (!done()) {
+			if (Clock::now() > deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return true;
+	}
+
+	// Every client sends DISCONNECT, so the broker ends the sessions as it does for well behaved clients
+	void DisconnectAll(Workers& workers, const std::vector<Client*>& clients) {
+		for (Client* client : clients) {
+			asio::post(client->Executor(), [client] { client->Disconnect(); });
+		}
+
+		uint64_t dropped = workers.Sum(&ThreadStats::dropped);
+		WaitFor([&] { return workers.Sum(&ThreadStats::finished) + dropped >= clients.size(); }, std::chrono::seconds(5));
+	}
+
+	void PrintLatency(const std::string& name, const Histogram& latency) {
+		auto us = [](uint64_t ns) { return double(ns) / 1000; };
+
+		std::cout << std::fixed << std::setprecision(1)
+				  << "  " << name << " (us): p50 " << us(latency.Percentile(0.5))
+				  << ", p99 " << us(latency.Percentile(0.99))
+				  << ", p99.9 " << us(latency.Percentile(0.999))
+				  << ", max " << us(latency.Max())
+				  << ", mean " << us(uint64_t(latency.Mean())) << '\n';
+	}
+
+	std::string PublishTopic(const Options& options, const std::string& prefix, size_t i) {
+		if (options.scenario == "fanout")
+			return prefix;
+		if (options.scenario == "wildcard")
+			return prefix + "/" + std::to_string(i) + "/data";
+		return prefix + "/" + std::to_string(i);
+	}
+
+	std::string Filter(const Options& options, const std::string& prefix, size_t i) {
+		if (options.scenario == "fanout")
+			return prefix;
+		if (options.scenario == "fanin")
+			return prefix + "/+";
+		if (options.scenario == "wildcard")
+			return i % 2 == 0 ? prefix + "/+/data" : prefix + "/#";
+		return prefix + "/" + std::to_string(i % options.publishers);
+	}
+
+	// Number of deliveries of one message of publisher i
+	size_t Receivers(const Options& options, size_t i) {
+		if (options.scenario != "pairs")
+			return options.subscribers;
+		return options.subscribers / options.publishers + (i < options.subscribers % options.publishers ? 1 : 0);
+	}
+
+	int RunPublish(const Options& options, const tcp::endpoint& endpoint, const std::string& prefix) {
+		Workers workers{ options.threads };
+		std::list<Client> subscribers, publishers;
+		std::atomic<size_t> ready{ 0 }, failed{ 0 };
+
+		auto open = [&](Client& client, size_t thread, std::string client_id, std::vector<std::string> filters) {
+			workers.Run(thread, [&, client_id, filters]() -> asio::awaitable<void> {
+				if (co_await client.Open(endpoint, client_id, filters)) {
+					client.Start();
+					ready++;
+				}
+				else {
+					failed++;
+				}
+			});
+		};
+
+		for (size_t i = 0; i < options.subscribers; i++) {
+			subscribers.emplace_back(workers.Context(i), workers.Stats(i), options);
+			open(subscribers.back(), i, prefix + "-s" + std::to_string(i), { Filter(options, prefix, i) });
+		}
+
+		for (size_t i = 0; i < options.publishers; i++) {
+			publishers.emplace_back(workers.Context(i), workers.Stats(i), options);
+			open(publishers.back(), i, prefix + "-p" + std::to_string(i), {});
+		}
+
+		size_t clients = options.subscribers + options.publishers;
+
+		if (!WaitFor([&] { return ready + failed == clients; }, std::chrono::seconds(60)) || failed > 0) {
+			std::cerr << "only " << ready << " of " << clients << " clients connected\n";
+			workers.Stop();
+			return -1;
+		}
+
+		auto start = Clock::now();
+		auto deadline = start + std::chrono::seconds(options.seconds);
+		std::atomic<size_t> publishing{ options.publishers };
+		size_t i = 0;
+
+		for (auto& client : publishers) {
+			workers.Run(i, [&, topic = PublishTopic(options, prefix, i)]() -> asio::awaitable<void> {
+				co_await client.Publish(topic, deadline);
+				publishing--;
+			});
+			i++;
+		}
+
+		// publishers stop at the deadline, the messages on the way are waited for a while
+		WaitFor([&] { return publishing == 0; }, std::chrono::seconds(options.seconds + 5));
+		auto expected = [&] {
+			uint64_t sum = 0;
+			size_t i = 0;
+			for (auto& client : publishers) {
+				sum += client.Sent() * Receivers(options, i++);
+			}
+			return sum;
+		};
+
+		WaitFor([&] { return workers.Sum(&ThreadStats::received) >= expected(); }, std::chrono::seconds(5));
+
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		uint64_t dropped = workers.Sum(&ThreadStats::dropped);
+
+		std::vector<Client*> all;
+		for (auto* list : { &subscribers, &publishers }) {
+			for (auto& client : *list) {
+				all.push_back(&client);
+			}
+		}
+		DisconnectAll(workers, all);
+		workers.Stop();
+
+		uint64_t sent = workers.Sum(&ThreadStats::sent);
+		uint64_t received = workers.Sum(&ThreadStats::received);
+		uint64_t missing = expected() > received ? expected() - received : 0;
+		Histogram latency = workers.Latency();
+		double seconds = double(options.seconds);
+
+		std::cout << "scenario: " << options.scenario << ", publishers: " << options.publishers
+				  << ", subscribers: " << options.subscribers << ", qos: " << int(options.qos)
+				  << ", payload: " << options.payload << " bytes, rate: " << options.rate
+				  << ", seconds: " << options.seconds << '\n'
+				  << std::fixed << std::setprecision(0)
+				  << "  sent:      " << sent << " messages, " << sent / seconds << " msg/sec\n"
+				  << "  delivered: " << received << " messages, " << received / elapsed.count() << " msg/sec"
+				  << " (" << missing << " missing)\n";
+
+		if (dropped > 0) {
+			std::cout << "  " << dropped << " clients were disconnected by the broker\n";
+		}
+
+		PrintLatency("latency", latency);
+		return 0;
+	}
+
+	/*
+	*  Connections are opened in -k lanes, every lane opens its next connection
+	*  when the previous one has its CONNACK and SUBACK. filters(i) are the filters of client i
+	*/
+	template<class Filters>
+	void OpenInLanes(Workers& workers, std::vector<std::unique_ptr<Client>>& clients, const Options& options,
+		const tcp::endpoint& endpoint, const std::string& prefix, Filters filters) {
+
+		for (size_t i = 0; i < options.connections; i++) {
+			size_t lane = i % options.parallel;
+			clients.push_back(std::make_unique<Client>(workers.Context(lane), workers.Stats(lane), options));
+		}
+
+		for (size_t lane = 0; lane < std::min(options.parallel, options.connections); lane++) {
+			workers.Run(lane, [&, lane, filters]() -> asio::awaitable<void> {
+				ThreadStats& stats = workers.Stats(lane);
+
+				for (size_t i = lane; i < clients.size(); i += options.parallel) {
+					uint64_t begin = Now();
+
+					if (co_await clients[i]->Open(endpoint, prefix + "-c" + std::to_string(i), filters(i))) {
+						clients[i]->Start();
+						stats.latency.Record(Now() - begin);
+						stats.connected.fetch_add(1, std::memory_order_relaxed);
+					}
+					else {
+						stats.failed.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			});
+		}
+
+		WaitFor([&] {
+			return workers.Sum(&ThreadStats::connected) + workers.Sum(&ThreadStats::failed) == options.connections;
+		}, std::chrono::minutes(5));
+	}
+
+	// All connections stay open until the end
+	int RunStorm(const Options& options, const tcp::endpoint& endpoint, const std::string& prefix) {
+		Workers workers{ options.threads };
+		std::vector<std::unique_ptr<Client>> clients;
+
+		auto start = Clock::now();
+		OpenInLanes(workers, clients, options, endpoint, prefix, [](size_t) { return std::vector<std::string>{}; });
+
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+
+		std::vector<Client*> open;
+		for (auto& client : clients) {
+			if (client->Connected()) {
+				open.push_back(client.get());
+			}
+		}
+		DisconnectAll(workers, open);
+		workers.Stop();
+
+		uint64_t connected = workers.Sum(&ThreadStats::connected);
+		uint64_t failed = workers.Sum(&ThreadStats::failed);
+
+		std::cout << "scenario: storm, connections: " << options.connections << ", parallel: " << options.parallel << '\n'
+				  << std::fixed << std::setprecision(0)
+				  << "  connected: " << connected << ", " << connected / elapsed.count() << " connections/sec"
+				  << " (" << failed << " failed, " << options.connections - connected - failed << " unanswered)\n";
+
+		PrintLatency("CONNACK latency", workers.Latency());
+		return 0;
+	}
+
+	int64_t BrokerSubscriptions() {
+		return network::server.CollectMetrics().counters[network::kSubscriptions];
+	}
+
+	/*
+	*  Every client is in the subscribers of one big topic and has a topic of its own, then all
+	*  sockets are closed without DISCONNECT at the same moment, like when a network link goes down.
+	*  The broker finishes when the gauge of subscriptions is back where it started
+	*/
+	int RunTeardown(const Options& options, const tcp::endpoint& endpoint, const std::string& prefix) {
+		Workers workers{ options.threads };
+		std::vector<std::unique_ptr<Client>> clients;
+		int64_t before = BrokerSubscriptions();
+
+		OpenInLanes(workers, clients, options, endpoint, prefix, [&prefix](size_t i) {
+			return std::vector<std::string>{ prefix + "/all", prefix + "/c/" + std::to_string(i) };
+		});
+
+		uint64_t connected = workers.Sum(&ThreadStats::connected);
+		int64_t subscribed = before + int64_t(connected) * 2;
+
+		if (!WaitFor([&] { return BrokerSubscriptions() >= subscribed; }, std::chrono::seconds(10))) {
+			std::cerr << "the broker has " << BrokerSubscriptions() - before << " of " << connected * 2 << " subscriptions\n";
+			workers.Stop();
+			return -1;
+		}
+
+		auto start = Clock::now();
+
+		for (auto& client : clients) {
+			asio::post(client->Executor(), [client = client.get()] { client->Close(); });
+		}
+
+		bool done = WaitFor([&] { return BrokerSubscriptions() <= before; }, std::chrono::minutes(5));
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		workers.Stop();
+
+		std::cout << "scenario: teardown, connections: " << options.connections << ", connected: " << connected << '\n'
+				  << std::fixed << std::setprecision(1)
+				  << "  subscriptions removed: " << subscribed - BrokerSubscriptions() << " of " << connected * 2
+				  << " in " << elapsed.count() * 1000 << " ms";
+
+		if (done && elapsed.count() > 0) {
+			std::cout << std::setprecision(0) << ", " << double(connected) / elapsed.count() << " sessions/sec";
+		}
+		std::cout << '\n';
+
+		return done ? 0 : -1;
+	}
+
+	int64_t BrokerConnected() {
+		network::MetricsSnapshot metrics = network::server.CollectMetrics();
+		return metrics.counters[network::kConnects] - metrics.counters[network::kDisconnects];
+	}
+
+	/*
+	*  The sessions outlive a network failure and all clients come back at once, like after a restart
+	*  of a load balancer. The first round only sets up the sessions, the second one is measured
+	*/
+	int RunReadmit(Options options, const tcp::endpoint& endpoint, const std::string& prefix) {
+		options.clean = false;
+
+		int64_t before = BrokerConnected();
+		int64_t subscriptions = BrokerSubscriptions();
+		uint64_t sessions = 0;
+		{
+			Workers workers{ options.threads };
+			std::vector<std::unique_ptr<Client>> clients;
+
+			OpenInLanes(workers, clients, options, endpoint, prefix, [&prefix](size_t i) {
+				return std::vector<std::string>{ prefix + "/c/" + std::to_string(i) };
+			});
+			sessions = workers.Sum(&ThreadStats::connected);
+
+			for (auto& client : clients) {
+				asio::post(client->Executor(), [client = client.get()] { client->Close(); });
+			}
+
+			bool dropped = WaitFor([&] { return BrokerConnected() <= before; }, std::chrono::minutes(1));
+			workers.Stop();
+
+			if (!dropped) {
+				std::cerr << "the broker still has " << BrokerConnected() - before << " connections of the first round\n";
+				return -1;
+			}
+		}
+		subscriptions = BrokerSubscriptions() - subscriptions;
+
+		Workers workers{ options.threads };
+		std::vector<std::unique_ptr<Client>> clients;
+
+		// the same client ids take their sessions back, the subscriptions are still there
+		auto start = Clock::now();
+		OpenInLanes(workers, clients, options, endpoint, prefix, [](size_t) { return std::vector<std::string>{}; });
+
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		workers.Stop();
+
+		uint64_t connected = workers.Sum(&ThreadStats::connected);
+		uint64_t failed = workers.Sum(&ThreadStats::failed);
+
+		std::cout << "scenario: readmit, connections: " << options.connections << ", parallel: " << options.parallel
+				  << ", connect rate: " << options.connect_rate << '\n'
+				  << "  sessions: " << sessions << ", subscriptions kept: " << subscriptions << '\n'
+				  << std::fixed << std::setprecision(1)
+				  << "  readmitted: " << connected << " in " << elapsed.count() * 1000 << " ms"
+				  << std::setprecision(0) << ", " << connected / elapsed.count() << " connections/sec"
+				  << " (" << failed << " failed, " << options.connections - connected - failed << " unanswered)\n";
+
+		PrintLatency("CONNACK latency", workers.Latency());
+		return connected == sessions ? 0 : -1;
+	}
+}
+
+int main(int argc, char* argv[]) {
+
+	Options options;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+
+		if (arg == "-s")
+			options.scenario = argv[i + 1];
+		else if (arg == "-h")
+			options.host = argv[i + 1];
+		else if (arg == "-p")
+			options.port = std::atoi(argv[i + 1]);
+		else if (arg == "-P")
+			options.publishers = std::atol(argv[i + 1]);
+		else if (arg == "-S")
+			options.subscribers = std::atol(argv[i + 1]);
+		else if (arg == "-q")
+			options.qos = uint8_t(std::atoi(argv[i + 1]));
+		else if (arg == "-b")
+			options.payload = std::atol(argv[i + 1]);
+		else if (arg == "-r")
+			options.rate = std::atol(argv[i + 1]);
+		else if (arg == "-d")
+			options.seconds = std::atol(argv[i + 1]);
+		else if (arg == "-i")
+			options.inflight = std::atol(argv[i + 1]);
+		else if (arg == "-c")
+			options.connections = std::atol(argv[i + 1]);
+		else if (arg == "-k")
+			options.parallel = std::atol(argv[i + 1]);
+		else if (arg == "-T")
+			options.threads = std::atol(argv[i + 1]);
+		else if (arg == "-e")
+			options.broker_threads = std::atol(argv[i + 1]);
+		else if (arg == "-cr")
+			options.connect_rate = std::atof(argv[i + 1]);
+	}
+
+	bool publish = options.scenario == "fanout" || options.scenario == "fanin"
+		|| options.scenario == "pairs" || options.scenario == "wildcard";
+
+	bool teardown = options.scenario == "teardown";
+	bool readmit = options.scenario == "readmit";
+
+	if ((!publish && options.scenario != "storm" && !teardown && !readmit)
+		|| ((teardown || readmit) && options.broker_threads == 0)
+		|| options.qos > 2 || options.publishers == 0
+		|| options.threads == 0 || options.parallel == 0 || options.inflight == 0) {
+		std::cerr << "usage: mqtt_bench -s fanout|fanin|pairs|wildcard|storm|teardown|readmit [-P publishers] [-S subscribers]"
+				  << " [-q qos] [-b payload] [-r rate] [-d seconds] [-i inflight] [-c connections] [-k parallel]"
+				  << " [-T threads] [-e broker_threads [-cr connects_per_second] | -h host -p port]\n";
+		return -1;
+	}
+
+	// the payload carries the time of sending
+	options.payload = std::max<size_t>(options.payload, sizeof(uint64_t));
+
+	tcp::endpoint endpoint{ asio::ip::make_address(options.host), options.port };
+	std::thread broker;
+
+	if (options.broker_threads > 0) {
+		network::logger.Start("mqtt_bench.log", error);
+		network::server.Init(options.broker_threads);
+		network::server.SetConnectRate(options.connect_rate);
+
+		endpoint = network::server.Listen({ asio::ip::make_address("127.0.0.1"), 0 });
+		broker = std::thread([] { network::server.Run(); });
+	}
+
+	// every run has its own client ids and topics, so sessions of other runs do not interfere
+	std::string prefix = "bench/" + std::to_string(Now() / 1000000);
+	int rc = publish ? RunPublish(options, endpoint, prefix)
+		: teardown ? RunTeardown(options, endpoint, prefix)
+		: readmit ? RunReadmit(options, endpoint, prefix) : RunStorm(options, endpoint, prefix);
+
+	if (broker.joinable()) {
+		network::server.Stop();
+		broker.join();
+		network::logger.Stop();
+	}
+
+	return rc;
+}
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../utility/frame_decoder.hpp"
+#include "../utility/mqtt.hpp"
+
+/*
+*  Throughput of the packet decoders on a stream of client packets: PUBLISH with QoS 0 and 1,
+*  PUBACK, SUBSCRIBE and PINGREQ. The checked decoders of utility/mqtt.cpp are compared with
+*  decoders that trust every length, as the server had before the checks were added.
+*
+*    ./bench_packet_decode -n packets -p payload -r rounds
+*/
+
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+// Decoders without checks, the fields are read wherever the lengths point.
+// They are kept out of line like the decoders of mqtt.cpp, which the benchmark calls across translation units
+namespace unchecked {
+
+	static size_t Body(const uint8_t* frame, mqtt::Header* head) {
+		size_t len_bytes = 1;
+		head->bits = frame[0];
+		head->remaining_length = uint32_t(mqtt::DecodeLength(frame + 1, MAX_LENGTH_BYTES, &len_bytes));
+		return 1 + len_bytes;
+	}
+
+	NOINLINE static void Publish(const uint8_t* frame, mqtt::PublishView* pkt) {
+		const uint8_t* buffer = frame + Body(frame, &pkt->header);
+		size_t topic_len = (buffer[0] << 8u) | buffer[1];
+		size_t header_len = 2 + topic_len;
+
+		pkt->topic = std::string_view((const char*)buffer + 2, topic_len);
+		buffer += header_len;
+
+		if ((pkt->header.bits & 0x6) != 0) {
+			pkt->pkt_id = (buffer[0] << 8u) | buffer[1];
+			buffer += 2;
+			header_len += 2;
+		}
+		pkt->payload = std::string_view((const char*)buffer, pkt->header.remaining_length - header_len);
+	}
+
+	NOINLINE static void Subscribe(const uint8_t* frame, mqtt::Subscribe* pkt) {
+		const uint8_t* buffer = frame + Body(frame, &pkt->header);
+		size_t remaining_len = pkt->header.remaining_length - 2;
+
+		pkt->pkt_id = (buffer[0] << 8u) | buffer[1];
+		buffer += 2;
+
+		while (remaining_len > 0) {
+			uint16_t topic_len = (buffer[0] << 8u) | buffer[1];
+			pkt->topic_and_qos.emplace_back(std::string((const char*)buffer + 2, topic_len), buffer[2 + topic_len]);
+			buffer += 3 + topic_len;
+			remaining_len -= 3 + topic_len;
+		}
+	}
+
+	NOINLINE static void Ack(const uint8_t* frame, mqtt::AckPacket* pkt) {
+		const uint8_t* buffer = frame + Body(frame, &pkt->header);
+		pkt->pkt_id = (buffer[0] << 8u) | buffer[1];
+	}
+}
+
+static std::vector<uint8_t> MakeStream(size_t packets, size_t payload) {
+	std::mt19937_64 rng{ 42 };
+	std::vector<uint8_t> stream;
+	std::string data(payload, 'x');
+
+	for (size_t i = 0; i < packets; i++) {
+		std::string topic = "building/" + std::to_string(rng() % 100) + "/floor/" + std::to_string(rng() % 10) + "/sensor";
+		uint16_t id = uint16_t(1 + i % 65535);
+		shared_bytes pkt;
+
+		switch (rng() % 20) {
+		case 0: {
+			// SUBSCRIBE with two filters
+			std::vector<uint8_t> sub{ 0x82, 0, uint8_t(id >> 8u), uint8_t(id) };
+			for (std::string_view filter : { std::string_view{ topic }, std::string_view{ "building/+/floor/#" } }) {
+				sub.push_back(uint8_t(filter.size() >> 8u));
+				sub.push_back(uint8_t(filter.size()));
+				sub.insert(sub.end(), filter.begin(), filter.end());
+				sub.push_back(1);
+			}
+			sub[1] = uint8_t(sub.size() - 2);
+			pkt = std::make_shared<const std::vector<uint8_t>>(std::move(sub));
+			break;
+		}
+		case 1:
+			pkt = std::make_shared<const std::vector<uint8_t>>(std::vector<uint8_t>{ 0xC0, 0 });
+			break;
+		case 2: case 3: case 4: case 5:
+			pkt = std::make_shared<const std::vector<uint8_t>>(std::vector<uint8_t>{ PUBACK_BYTE, 2, uint8_t(id >> 8u), uint8_t(id) });
+			break;
+		default:
+			pkt = mqtt::EncodePublish(i % 2 == 0 ? 0x30 : 0x32, id, topic, data);
+		}
+		stream.insert(stream.end(), pkt->begin(), pkt->end());
+	}
+	return stream;
+}
+
+// Cuts the stream into frames like Session::ReadBytes and decodes every frame
+template<bool Checked>
+static size_t DecodeStream(const std::vector<uint8_t>& stream) {
+	mqtt::FrameDecoder decoder;
+	size_t begin = 0;
+	size_t sum = 0;
+
+	while (decoder.Parse(stream.data() + begin, stream.size() - begin) == mqtt::FrameDecoder::kFrame) {
+		const uint8_t* frame = stream.data() + begin;
+		size_t size = decoder.FrameSize();
+
+		switch (frame[0] >> 4u) {
+		case PUBLISH: {
+			mqtt::PublishView pub;
+			if constexpr (Checked) {
+				sum += mqtt::UnpackPublish(frame, size, &pub);
+			}
+			else {
+				unchecked::Publish(frame, &pub);
+			}
+			sum += pub.pkt_id + pub.topic.size() + pub.payload.size();
+			break;
+		}
+		case SUBSCRIBE: {
+			mqtt::Subscribe sub;
+			if constexpr (Checked) {
+				sum += mqtt::UnpackSubscribe(frame, size, &sub);
+			}
+			else {
+				unchecked::Subscribe(frame, &sub);
+			}
+			sum += sub.pkt_id + sub.topic_and_qos.size();
+			break;
+		}
+		case PINGREQ: {
+			mqtt::Header head;
+			if constexpr (Checked) {
+				sum += mqtt::UnpackHeader(frame, size, &head);
+			}
+			sum++;
+			break;
+		}
+		default: {
+			mqtt::AckPacket ack;
+			if constexpr (Checked) {
+				sum += mqtt::UnpackAck(frame, size, &ack);
+			}
+			else {
+				unchecked::Ack(frame, &ack);
+			}
+			sum += ack.pkt_id;
+		}
+		}
+
+		begin += size;
+		decoder.Reset();
+	}
+	return sum;
+}
+
+template<bool Checked>
+static double DecodeTime(const std::vector<uint8_t>& stream, size_t* sum) {
+	auto start = std::chrono::steady_clock::now();
+
+	*sum += DecodeStream<Checked>(stream);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+static void Report(const std::string& name, const std::vector<uint8_t>& stream, size_t packets, double seconds, size_t sum) {
+	std::cout << "  " << name << ": " << size_t(packets / seconds) << " packets/sec, "
+		<< size_t(stream.size() / seconds / (1024 * 1024)) << " MiB/sec (" << sum << ")\n";
+}
+
+int main(int argc, char* argv[]) {
+
+	size_t packets = 1'000'000;
+	size_t payload = 64;
+	size_t rounds = 10;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+
+		if (arg == "-n")
+			packets = std::atol(argv[i + 1]);
+		else if (arg == "-p")
+			payload = std::atol(argv[i + 1]);
+		else if (arg == "-r")
+			rounds = std::atol(argv[i + 1]);
+	}
+
+	std::vector<uint8_t> stream = MakeStream(packets, payload);
+
+	std::cout << "packets: " << packets << ", payload: " << payload << ", stream: " << stream.size() << " bytes\n";
+
+	// warm up the caches and the allocator
+	DecodeStream<true>(stream);
+
+	// the rounds alternate and the fastest round of each decoder is taken, so noise of the machine does not count
+	double unchecked = 1e9, checked = 1e9;
+	size_t unchecked_sum = 0, checked_sum = 0;
+
+	for (size_t i = 0; i < rounds; i++) {
+		unchecked = std::min(unchecked, DecodeTime<false>(stream, &unchecked_sum));
+		checked = std::min(checked, DecodeTime<true>(stream, &checked_sum));
+	}
+
+	Report("unchecked", stream, packets, unchecked, unchecked_sum);
+	Report("checked  ", stream, packets, checked, checked_sum);
+
+	std::cout << "validation overhead: " << (checked / unchecked - 1) * 100 << "%\n";
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "client.hpp"
+
+/*
+*  Measures PUBLISH -> subscriber latency while N idle clients are connected.
+*  Run it with a growing -n to check that delivery does not depend
+*  on the number of connected clients.
+*
+*    ./bench_publish_latency -n idle_clients -m messages -p port -h host
+*/
+
+int main(int argc, char* argv[]) {
+
+	std::string host = "127.0.0.1";
+	uint16_t port = 1883;
+	size_t idle_clients = 1000;
+	size_t messages = 10000;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+
+		if (arg == "-h")
+			host = argv[i + 1];
+		else if (arg == "-p")
+			port = std::atoi(argv[i + 1]);
+		else if (arg == "-n")
+			idle_clients = std::atol(argv[i + 1]);
+		else if (arg == "-m")
+			messages = std::atol(argv[i + 1]);
+	}
+
+	// every run uses its own topic, so subscriptions left by other runs do not interfere
+	std::string topic = "bench/latency/" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+	asio::io_context io;
+	std::list<bench::Client> idle;
+
+	for (size_t i = 0; i < idle_clients; i++) {
+		idle.emplace_back(io);
+		idle.back().Open(host, port);
+		idle.back().Connect("bench-idle-" + std::to_string(i));
+	}
+
+	bench::Client subscriber{ io };
+	subscriber.Open(host, port);
+	subscriber.Connect("bench-subscriber");
+	subscriber.Subscribe(topic, 0);
+
+	bench::Client publisher{ io };
+	publisher.Open(host, port);
+	publisher.Connect("bench-publisher");
+
+	std::vector<double> latencies;
+	latencies.reserve(messages);
+	std::string payload(64, 'x');
+
+	for (size_t i = 0; i < messages; i++) {
+		auto start = std::chrono::steady_clock::now();
+
+		publisher.Publish(topic, payload);
+		subscriber.ReadPacket();
+
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		latencies.push_back(elapsed.count());
+	}
+
+	publisher.Disconnect();
+	subscriber.Disconnect();
+	for (auto& client : idle) {
+		client.Disconnect();
+	}
+
+	std::sort(begin(latencies), end(latencies));
+
+	auto percentile = [&](double p) {
+		return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+	};
+
+	std::cout << "idle clients: " << idle_clients << '\n'
+			  << "messages:     " << messages << '\n'
+			  << "p50 (us):     " << percentile(0.50) << '\n'
+			  << "p99 (us):     " << percentile(0.99) << '\n'
+			  << "max (us):     " << latencies.back() << '\n';
+}
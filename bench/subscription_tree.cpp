@@ -0,0 +1,99 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../utility/trie.hpp"
+#include "../utility/flat_trie.hpp"
+
+/*
+*  Compares tree::trie and tree::flat_trie on a subscription tree with N topics:
+*  insert, exact match of existing topics and wildcard match of published topics
+*  against the same tree with 200 extra '+' and '#' filters.
+*
+*    ./bench_subscription_tree -n topics -l lookups -t node|flat|both
+*/
+
+static std::string MakeTopic(size_t i) {
+	return "building/" + std::to_string(i % 100) + "/floor/" + std::to_string(i / 100 % 100)
+		+ "/sensor/" + std::to_string(i / 10000);
+}
+
+template<class F>
+static void Measure(const std::string& name, size_t ops, F&& f) {
+	auto start = std::chrono::steady_clock::now();
+
+	size_t found = f();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "  " << name << ": " << size_t(ops / elapsed.count()) << " ops/sec (" << found << ")\n";
+}
+
+template<class Tree>
+static void Run(const std::string& name, size_t topics, const std::vector<std::string>& lookups) {
+	Tree tr;
+
+	std::cout << name << '\n';
+
+	Measure("insert        ", topics, [&] {
+		for (size_t i = 0; i < topics; i++) {
+			tr.get(MakeTopic(i)) = 1;
+		}
+		return topics;
+	});
+
+	Measure("exact match   ", lookups.size(), [&] {
+		size_t found = 0;
+		for (const auto& topic : lookups) {
+			int* data = tr.find(topic);
+			found += data != nullptr ? *data : 0;
+		}
+		return found;
+	});
+
+	for (size_t i = 0; i < 100; i++) {
+		tr.get("building/" + std::to_string(i) + "/floor/+/sensor/+") = 1;
+		tr.get("building/+/floor/" + std::to_string(i) + "/#") = 1;
+	}
+
+	Measure("wildcard match", lookups.size(), [&] {
+		size_t found = 0;
+		for (const auto& topic : lookups) {
+			tr.match(topic, [&](int& data) { found += data; });
+		}
+		return found;
+	});
+}
+
+int main(int argc, char* argv[]) {
+
+	size_t topics = 1'000'000;
+	size_t lookups = 1'000'000;
+	std::string layout = "both";
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+
+		if (arg == "-n")
+			topics = std::atol(argv[i + 1]);
+		else if (arg == "-l")
+			lookups = std::atol(argv[i + 1]);
+		else if (arg == "-t")
+			layout = argv[i + 1];
+	}
+
+	std::mt19937_64 rng{ 42 };
+	std::vector<std::string> existing;
+
+	for (size_t i = 0; i < lookups; i++) {
+		existing.push_back(MakeTopic(rng() % topics));
+	}
+
+	std::cout << "topics: " << topics << ", lookups: " << lookups << '\n';
+
+	if (layout != "flat")
+		Run<tree::trie<int>>("trie", topics, existing);
+	if (layout != "node")
+		Run<tree::flat_trie<int>>("flat_trie", topics, existing);
+}
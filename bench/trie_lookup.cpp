@@ -0,0 +1,92 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../utility/trie.hpp"
+
+/*
+*  Lookups per second on a subscription tree with N topics.
+*
+*    ./bench_trie_lookup -n topics -l lookups
+*/
+
+static std::string MakeTopic(size_t i) {
+	return "building/" + std::to_string(i % 100) + "/floor/" + std::to_string(i / 100 % 100)
+		+ "/sensor/" + std::to_string(i / 10000);
+}
+
+template<class F>
+static void Measure(const std::string& name, size_t lookups, F&& f) {
+	auto start = std::chrono::steady_clock::now();
+
+	size_t found = f();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << name << ": " << size_t(lookups / elapsed.count()) << " lookups/sec (" << found << " found)\n";
+}
+
+int main(int argc, char* argv[]) {
+
+	size_t topics = 1'000'000;
+	size_t lookups = 1'000'000;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+
+		if (arg == "-n")
+			topics = std::atol(argv[i + 1]);
+		else if (arg == "-l")
+			lookups = std::atol(argv[i + 1]);
+	}
+
+	tree::trie<int> tr;
+
+	for (size_t i = 0; i < topics; i++) {
+		tr.get(MakeTopic(i)) = 1;
+	}
+
+	std::mt19937_64 rng{ 42 };
+	std::vector<std::string> existing;
+	std::vector<std::string> missing;
+
+	for (size_t i = 0; i < lookups; i++) {
+		existing.push_back(MakeTopic(rng() % topics));
+		missing.push_back("building/" + std::to_string(rng() % 100) + "/unknown/" + std::to_string(i));
+	}
+
+	std::cout << "topics: " << topics << '\n';
+
+	Measure("find existing", lookups, [&] {
+		size_t found = 0;
+		for (const auto& topic : existing) {
+			found += tr.find(topic) != nullptr;
+		}
+		return found;
+	});
+
+	Measure("find missing ", lookups, [&] {
+		size_t found = 0;
+		for (const auto& topic : missing) {
+			found += tr.find(topic) != nullptr;
+		}
+		return found;
+	});
+
+	Measure("match        ", lookups, [&] {
+		size_t found = 0;
+		for (const auto& topic : existing) {
+			tr.match(topic, [&](int& data) { found += data; });
+		}
+		return found;
+	});
+
+	Measure("get existing ", lookups, [&] {
+		size_t found = 0;
+		for (const auto& topic : existing) {
+			found += tr.get(topic);
+		}
+		return found;
+	});
+}
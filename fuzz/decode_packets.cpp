@@ -0,0 +1,112 @@
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "../utility/frame_decoder.hpp"
+#include "../utility/mqtt.hpp"
+
+/*
+*  libFuzzer target of the packet decoders, AFL++ builds it as it is with afl-clang-fast++.
+*  The input is cut into frames like a stream of a client and every frame is decoded,
+*  the whole input is also decoded as one frame to reach the truncated cases.
+*  Fields of a decoded packet must lie inside the frame, any byte read outside of it is reported by ASan.
+*/
+
+static void Check(bool condition) {
+	if (!condition) {
+		__builtin_trap();
+	}
+}
+
+static bool Inside(const uint8_t* frame, size_t size, std::string_view field) {
+	return field.empty() || ((const uint8_t*)field.data() >= frame && (const uint8_t*)field.data() + field.size() <= frame + size);
+}
+
+static size_t Touch(std::string_view field) {
+	size_t sum = 0;
+	for (char c : field) {
+		sum += uint8_t(c);
+	}
+	return sum;
+}
+
+static void Decode(const uint8_t* frame, size_t size) {
+	if (size == 0) {
+		return;
+	}
+
+	volatile size_t sink = 0;
+
+	switch (frame[0] >> 4u) {
+	case CONNECT: {
+		mqtt::Connect con;
+		if (mqtt::UnpackConnect(frame, size, &con) == mqtt::kDecoded) {
+			Check(con.payload.cliend_id.size() + con.payload.will_topic.size() + con.payload.will_message.size()
+				+ con.payload.username.size() + con.payload.password.size() <= size);
+			Check((con.variable_header.connect_flags & 0x04) == 0 || mqtt::ValidTopicName(con.payload.will_topic));
+		}
+		break;
+	}
+	case PUBLISH: {
+		mqtt::PublishView pub;
+		if (mqtt::UnpackPublish(frame, size, &pub) == mqtt::kDecoded) {
+			Check(Inside(frame, size, pub.topic) && Inside(frame, size, pub.payload));
+			Check(((pub.header.bits >> 1u) & 3u) != 3);
+			Check(mqtt::ValidTopicName(pub.topic));
+			sink = Touch(pub.topic) + Touch(pub.payload);
+		}
+		break;
+	}
+	case SUBSCRIBE: {
+		mqtt::Subscribe sub;
+		if (mqtt::UnpackSubscribe(frame, size, &sub) == mqtt::kDecoded) {
+			Check(!sub.topic_and_qos.empty());
+			for (auto& [topic, qos] : sub.topic_and_qos) {
+				Check(qos <= 2);
+				sink = mqtt::ValidTopicFilter(topic);
+			}
+		}
+		break;
+	}
+	case UNSUBSCRIBE: {
+		mqtt::Unsubscribe unsub;
+		if (mqtt::UnpackUnsubscribe(frame, size, &unsub) == mqtt::kDecoded) {
+			Check(!unsub.topics.empty());
+		}
+		break;
+	}
+	case PINGREQ:
+	case DISCONNECT: {
+		mqtt::Header head;
+		if (mqtt::UnpackHeader(frame, size, &head) == mqtt::kDecoded) {
+			Check(head.remaining_length == 0);
+		}
+		break;
+	}
+	default: {
+		mqtt::AckPacket ack;
+		sink = mqtt::UnpackAck(frame, size, &ack);
+		break;
+	}
+	}
+	(void)sink;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	Decode(data, size);
+
+	mqtt::FrameDecoder decoder;
+	size_t begin = 0;
+
+	while (decoder.Parse(data + begin, size - begin) == mqtt::FrameDecoder::kFrame) {
+		// the frame is copied, so reading past its end is caught even when more input follows it
+		std::vector<uint8_t> frame(data + begin, data + begin + decoder.FrameSize());
+		Decode(frame.data(), frame.size());
+
+		begin += decoder.FrameSize();
+		decoder.Reset();
+	}
+
+	return 0;
+}
@@ -1,52 +1,218 @@
-﻿
-#include <boost/asio/signal_set.hpp>
-#include "network/server.hpp"
-
-
-int main(int argc, char* argv[]) {
-
-	std::string filename = "file.log";
-	asio::ip::port_type port = 1883;
-
-
-	for(int i = 1; i < argc; i += 2) {
-		if(std::string(argv[i]) == "-p") {
-			if (i + 1 < argc && argv[i + 1][0] != '-') {
-				port = std::atoi(argv[i + 1]);
-			}
-			else
-				return -1;
-		}
-		if(std::string(argv[i]) == "-f") {
-			if (i + 1 < argc)
-				filename = argv[i + 1];
-			else
-				return -1;
-		}
-	}
-
-	std::cout << "  __  __   ____  _______  _______         ____    __    __ \n" 
-			  << " |  \\/  | / __ \\|__   __||__   __|       |___ \\  /_ |  /_ | \n"
-			  << " | \\  / || |  | |  | |      | |    __   __ __) |  | |   | |\n"
-			  << " | |\\/| || |  | |  | |      | |    \\ \\ / /|__ <   | |   | |\n"
-			  << " | |  | || |__| |  | |      | |     \\ V / ___) |_ | | _ | |\n"
-			  << " |_|  |_| \\___\\_\\  |_|      |_|      \\_/ |____/(_)|_|(_)|_|\n";
-
-	std::cout << '\n' << "Filename: " << filename << " port: " << port << '\n';
-
-	asio::io_context io;
-	tcp::acceptor ac{ io, {tcp::v4(), port} };
-	asio::signal_set signals(io, SIGINT, SIGTERM);
-
-	try {
-
-		asio::co_spawn(io, network::server.Listen(std::move(ac), filename), asio::detached);
-
-		signals.async_wait([&](auto, auto) {io.stop(); });
-
-		io.run();
-	}
-	catch (std::exception&) {
-		Log(filename, info, 0, "Error in the main file");
-	}
+﻿
+#include <functional>
+#include <boost/asio/signal_set.hpp>
+#include "network/server.hpp"
+
+
+int main(int argc, char* argv[]) {
+
+	std::string filename = "file.log";
+	asio::ip::port_type port = 1883;
+	size_t threads = 1;
+	kMessageType level = info;
+	network::QueueLimits limits;
+	network::StoreOptions store_options;
+	network::kShareStrategy share_strategy = network::kShareRoundRobin;
+	long sys_interval = 10;
+	asio::ip::port_type metrics_port = 0;
+	double connect_rate = 0;
+
+
+	for(int i = 1; i < argc; i += 2) {
+		if(std::string(argv[i]) == "-p") {
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				port = std::atoi(argv[i + 1]);
+			}
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-f") {
+			if (i + 1 < argc)
+				filename = argv[i + 1];
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-t") {
+			if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+				threads = std::atoi(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-l") {
+			std::string name = i + 1 < argc ? argv[i + 1] : "";
+
+			if (name == "info")
+				level = info;
+			else if (name == "debug")
+				level = debug;
+			else if (name == "warning")
+				level = warning;
+			else if (name == "error")
+				level = error;
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-qm") {
+			if (i + 1 < argc && std::atol(argv[i + 1]) > 0)
+				limits.messages = std::atol(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-qb") {
+			if (i + 1 < argc && std::atol(argv[i + 1]) > 0)
+				limits.bytes = std::atol(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-qi") {
+			if (i + 1 < argc && std::atol(argv[i + 1]) > 0 && std::atol(argv[i + 1]) <= 65535)
+				limits.inflight = std::atol(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-q0") {
+			std::string name = i + 1 < argc ? argv[i + 1] : "";
+
+			if (name == "oldest")
+				limits.qos0 = network::kDropOldest;
+			else if (name == "newest")
+				limits.qos0 = network::kDropNewest;
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-q1") {
+			std::string name = i + 1 < argc ? argv[i + 1] : "";
+
+			if (name == "disconnect")
+				limits.reliable = network::kDisconnect;
+			else if (name == "spill")
+				limits.reliable = network::kSpill;
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-s") {
+			if (i + 1 < argc)
+				store_options.dir = argv[i + 1];
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-sf") {
+			std::string name = i + 1 < argc ? argv[i + 1] : "";
+
+			if (name == "never")
+				store_options.fsync = network::kFsyncNever;
+			else if (name == "interval")
+				store_options.fsync = network::kFsyncInterval;
+			else if (name == "always")
+				store_options.fsync = network::kFsyncAlways;
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-sh") {
+			std::string name = i + 1 < argc ? argv[i + 1] : "";
+
+			if (name == "roundrobin")
+				share_strategy = network::kShareRoundRobin;
+			else if (name == "leastqueued")
+				share_strategy = network::kShareLeastQueued;
+			else if (name == "sticky")
+				share_strategy = network::kShareSticky;
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-ms") {
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				sys_interval = std::atol(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-mp") {
+			if (i + 1 < argc && std::atoi(argv[i + 1]) > 0 && std::atoi(argv[i + 1]) <= 65535)
+				metrics_port = std::atoi(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-cr") {
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				connect_rate = std::atof(argv[i + 1]);
+			else
+				return -1;
+		}
+		if(std::string(argv[i]) == "-si") {
+			if (i + 1 < argc && std::atol(argv[i + 1]) > 0)
+				store_options.interval = std::chrono::milliseconds(std::atol(argv[i + 1]));
+			else
+				return -1;
+		}
+	}
+
+	std::cout << "  __  __   ____  _______  _______         ____    __    __ \n" 
+			  << " |  \\/  | / __ \\|__   __||__   __|       |___ \\  /_ |  /_ | \n"
+			  << " | \\  / || |  | |  | |      | |    __   __ __) |  | |   | |\n"
+			  << " | |\\/| || |  | |  | |      | |    \\ \\ / /|__ <   | |   | |\n"
+			  << " | |  | || |__| |  | |      | |     \\ V / ___) |_ | | _ | |\n"
+			  << " |_|  |_| \\___\\_\\  |_|      |_|      \\_/ |____/(_)|_|(_)|_|\n";
+
+	std::cout << '\n' << "Filename: " << filename << " port: " << port << " threads: " << threads
+			  << " log level: " << kEnumToString[level] << '\n';
+
+	network::logger.Start(filename, level);
+	network::server.Init(threads);
+	network::server.SetQueueLimits(limits);
+	network::server.SetShareStrategy(share_strategy);
+	network::server.SetConnectRate(connect_rate);
+
+	network::Store store;
+
+	if (!store_options.dir.empty()) {
+		if (!store.Open(store_options)) {
+			std::cout << "The store can not be opened: " << store_options.dir << '\n';
+			network::logger.Stop();
+			return -1;
+		}
+
+		network::server.SetStore(&store);
+		network::server.Restore();
+		store.Start();
+	}
+
+	asio::io_context& io = network::server.GetShard(0).io;
+	asio::signal_set signals(io, SIGINT, SIGTERM);
+	asio::signal_set dump(io, SIGUSR1);
+
+	// SIGUSR1 prints the metrics of the broker
+	std::function<void()> wait_dump = [&] {
+		dump.async_wait([&](const boost::system::error_code& ec, int) {
+			if (!ec) {
+				std::cout << network::server.CollectMetrics().Format() << std::flush;
+				wait_dump();
+			}
+		});
+	};
+
+	try {
+
+		network::server.Listen({ tcp::v4(), port });
+
+		if (sys_interval > 0) {
+			asio::co_spawn(io, network::server.PublishMetrics(std::chrono::seconds(sys_interval)), asio::detached);
+		}
+
+		if (metrics_port != 0) {
+			tcp::acceptor metrics{ io, { asio::ip::address_v4::loopback(), metrics_port } };
+			asio::co_spawn(io, network::server.ServeMetrics(std::move(metrics)), asio::detached);
+		}
+
+		wait_dump();
+
+		signals.async_wait([&](auto, auto) { network::server.Stop(); });
+
+		network::server.Run();
+	}
+	catch (std::exception&) {
+		Log(info, 0, "Error in the main file");
+	}
+
+	store.Close();
+	network::logger.Stop();
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "admission.hpp"
+
+#include <algorithm>
+
+void network::Admission::SetRate(double per_second, size_t burst) {
+	if (per_second <= 0) {
+		interval_ = std::chrono::nanoseconds(0);
+		tolerance_ = std::chrono::nanoseconds(0);
+		return;
+	}
+
+	interval_ = std::chrono::nanoseconds(std::max<int64_t>(1, int64_t(1e9 / per_second)));
+	tolerance_ = interval_ * int64_t(std::max<size_t>(burst, 1) - 1);
+}
+
+// The generic cell rate algorithm: due_ moves one interval per CONNECT, a CONNECT waits while it is ahead of now by more than the burst
+std::chrono::steady_clock::time_point network::Admission::Next(std::chrono::steady_clock::time_point now) {
+	std::chrono::steady_clock::time_point due = std::max(due_, now);
+
+	due_ = due + interval_;
+	return std::max(now, due - tolerance_);
+}
@@ -0,0 +1,33 @@
+#ifndef MQTT_NETWORK_ADMISSION_H_
+#define MQTT_NETWORK_ADMISSION_H_
+
+#include <chrono>
+#include <cstddef>
+
+namespace network {
+
+	/*
+	*  Budget of CONNECT packets one shard handles per second.
+	*  Every CONNECT is given the next free moment of the budget and waits for it, so after a restart
+	*  or a network failure the clients are admitted at a steady pace in the order they came, and
+	*  the clients that are already connected are not starved by the storm meanwhile.
+	*  After a quiet time up to burst CONNECT pass at once
+	*/
+	class Admission {
+	public:
+		// 0 is no limit
+		void SetRate(double per_second, size_t burst);
+		bool Limited() const { return interval_.count() > 0; }
+
+		// The moment the CONNECT may be handled, now if it may be handled at once
+		std::chrono::steady_clock::time_point Next(std::chrono::steady_clock::time_point now);
+
+	private:
+		std::chrono::nanoseconds interval_{ 0 };
+		std::chrono::nanoseconds tolerance_{ 0 }; // burst - 1 intervals
+		std::chrono::steady_clock::time_point due_;  // when the budget is used up to now
+	};
+
+} // namespace network
+
+#endif
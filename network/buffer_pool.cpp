@@ -0,0 +1,112 @@
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	// thread_local objects are destroyed before the static ones, so sessions owned by
+	// the server can outlive the pool of the main thread
+	thread_local bool local_pool_destroyed = false;
+}
+
+network::BufferPool::~BufferPool() {
+	for (auto& blocks : free_) {
+		for (uint8_t* block : blocks) {
+			delete[] block;
+		}
+	}
+}
+
+uint8_t* network::BufferPool::Acquire(size_t size_class) {
+	auto& blocks = free_[size_class];
+
+	if (blocks.empty()) {
+		return new uint8_t[ClassSize(size_class)];
+	}
+
+	uint8_t* block = blocks.back();
+	blocks.pop_back();
+	return block;
+}
+
+void network::BufferPool::Release(uint8_t* block, size_t size_class) {
+	auto& blocks = free_[size_class];
+
+	// big blocks are not worth keeping, the budget decides how many blocks stay in the pool
+	if ((blocks.size() + 1) * ClassSize(size_class) > kClassBudget) {
+		delete[] block;
+		return;
+	}
+
+	blocks.push_back(block);
+}
+
+size_t network::BufferPool::ClassFor(size_t len) {
+	size_t size_class = 0;
+
+	while (size_class + 1 < kClasses && ClassSize(size_class) < len) {
+		size_class++;
+	}
+
+	return size_class;
+}
+
+size_t network::BufferPool::ClassSize(size_t size_class) {
+	return std::min(kMinBlock << (2 * size_class), kMaxBlock);
+}
+
+network::BufferPool& network::BufferPool::Local() {
+	thread_local struct LocalPool : BufferPool {
+		~LocalPool() { local_pool_destroyed = true; }
+	} pool;
+	return pool;
+}
+
+network::ReceiveBuffer::ReceiveBuffer() : size_class_(0) {
+	data_ = BufferPool::Local().Acquire(size_class_);
+}
+
+network::ReceiveBuffer::~ReceiveBuffer() {
+	if (local_pool_destroyed) {
+		delete[] data_;
+		return;
+	}
+
+	BufferPool::Local().Release(data_, size_class_);
+}
+
+bool network::ReceiveBuffer::Reserve(size_t len, size_t keep) {
+	if (len <= capacity()) {
+		return true;
+	}
+
+	if (len > BufferPool::kMaxBlock) {
+		return false;
+	}
+
+	size_t size_class = BufferPool::ClassFor(len);
+	uint8_t* block = BufferPool::Local().Acquire(size_class);
+
+	std::memcpy(block, data_, std::min(keep, capacity()));
+	BufferPool::Local().Release(data_, size_class_);
+
+	data_ = block;
+	size_class_ = size_class;
+	return true;
+}
+
+void network::ReceiveBuffer::Shrink(size_t keep) {
+	size_t size_class = BufferPool::ClassFor(keep);
+
+	if (size_class >= size_class_) {
+		return;
+	}
+
+	uint8_t* block = BufferPool::Local().Acquire(size_class);
+
+	std::memcpy(block, data_, keep);
+	BufferPool::Local().Release(data_, size_class_);
+
+	data_ = block;
+	size_class_ = size_class;
+}
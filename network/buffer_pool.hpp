@@ -0,0 +1,71 @@
+#ifndef MQTT_NETWORK_BUFFER_POOL_H_
+#define MQTT_NETWORK_BUFFER_POOL_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace network {
+
+	/*
+	*  Pool of receive blocks split into size classes.
+	*  Class 0 is 256 bytes, every next class is 4 times bigger,
+	*  the last class is large enough for the biggest MQTT packet.
+	*  Free blocks are kept per class until the class budget is used up,
+	*  everything above the budget is returned to the system.
+	*/
+	class BufferPool {
+	public:
+		static constexpr size_t kMinBlock = 256;
+		static constexpr size_t kMaxBlock = 268'435'455 + 5; // max remaining length + fixed header
+		static constexpr size_t kClasses = 12;
+		static constexpr size_t kClassBudget = 4 * 1024 * 1024; // bytes of free blocks cached per class
+
+		~BufferPool();
+
+		uint8_t* Acquire(size_t size_class);
+		void Release(uint8_t* block, size_t size_class);
+
+		static size_t ClassFor(size_t len);
+		static size_t ClassSize(size_t size_class);
+
+		// Pool shared by all sessions served by the calling thread
+		static BufferPool& Local();
+
+	private:
+		std::array<std::vector<uint8_t*>, kClasses> free_;
+	};
+
+	/*
+	*  Receive buffer of a session.
+	*  It starts with the smallest block, grows when a packet does not fit
+	*  and goes back to the smallest block when Shrink() is called.
+	*/
+	class ReceiveBuffer {
+	public:
+		ReceiveBuffer();
+		ReceiveBuffer(const ReceiveBuffer&) = delete;
+		ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+		~ReceiveBuffer();
+
+		uint8_t* data() { return data_; }
+		const uint8_t* data() const { return data_; }
+		size_t capacity() const { return BufferPool::ClassSize(size_class_); }
+
+		uint8_t& operator[](size_t i) { return data_[i]; }
+
+		// Makes room for len bytes, the first keep bytes are preserved. Returns false if len is too big
+		bool Reserve(size_t len, size_t keep = 0);
+
+		// Returns the block to the smallest class, the first keep bytes are preserved
+		void Shrink(size_t keep = 0);
+
+	private:
+		uint8_t* data_;
+		size_t size_class_;
+	};
+
+} // namespace network
+
+#endif
@@ -0,0 +1,74 @@
+#include "client_table.hpp"
+
+#include <functional>
+
+namespace {
+
+	// the generation never reaches 0xFF, so no handle is kNoHandle
+	constexpr uint32_t kGenerations = (network::kNoHandle >> network::ClientTable::kHandleIndexBits);
+
+} // namespace
+
+uint32_t network::ClientTable::Intern(const std::string& client_id, Session* session) {
+	uint32_t index;
+
+	if (!free_.empty()) {
+		index = free_.back();
+		free_.pop_back();
+	}
+	else if (entries_.size() > kHandleIndexMask) {
+		return kNoHandle;
+	}
+	else {
+		index = uint32_t(entries_.size());
+		entries_.emplace_back();
+	}
+
+	Entry& entry = entries_[index];
+	entry.id = client_id;
+	entry.hash = std::hash<std::string>{}(client_id);
+	entry.session = session;
+
+	// the key must be the string of the newest entry, the older one is cleared when it is released
+	ids_.erase(entry.id);
+	ids_.emplace(entry.id, index);
+	return (entry.generation << kHandleIndexBits) | index;
+}
+
+void network::ClientTable::Release(uint32_t handle) {
+	uint32_t index = handle & kHandleIndexMask;
+
+	if (Find(handle) == nullptr) {
+		return;
+	}
+
+	Entry& entry = entries_[index];
+
+	// the id may already belong to a newer session of the client
+	if (auto it = ids_.find(entry.id); it != ids_.end() && it->second == index) {
+		ids_.erase(it);
+	}
+
+	entry.id.clear();
+	entry.session = nullptr;
+	entry.generation = (entry.generation + 1) % kGenerations;
+	free_.push_back(index);
+}
+
+network::Session* network::ClientTable::Find(uint32_t handle) const {
+	uint32_t index = handle & kHandleIndexMask;
+
+	if (index >= entries_.size() || entries_[index].generation != (handle >> kHandleIndexBits)) {
+		return nullptr;
+	}
+	return entries_[index].session;
+}
+
+uint32_t network::ClientTable::Lookup(std::string_view client_id) const {
+	auto it = ids_.find(client_id);
+
+	if (it == ids_.end()) {
+		return kNoHandle;
+	}
+	return (entries_[it->second].generation << kHandleIndexBits) | it->second;
+}
@@ -0,0 +1,67 @@
+#ifndef MQTT_NETWORK_CLIENT_TABLE_H_
+#define MQTT_NETWORK_CLIENT_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace network {
+
+	class Session;
+
+	// Handle of no client
+	constexpr uint32_t kNoHandle = UINT32_MAX;
+
+	/*
+	*  Client ids of one shard interned into 32 bit handles, routing compares and indexes only these.
+	*  The low kHandleIndexBits of a handle are the slot in a dense array, the high bits are the
+	*  generation of the slot. A slot gets a new generation when it is released, so a handle that is
+	*  still on its way to the shard after its client has gone does not reach the next client of the slot.
+	*  The generation wraps after 255 releases of the slot, a handle held across that many clients
+	*  of one slot would reach the newest one, the handles in flight are far younger than that
+	*/
+	class ClientTable {
+	public:
+		static constexpr int kHandleIndexBits = 24;
+		static constexpr uint32_t kHandleIndexMask = (uint32_t(1) << kHandleIndexBits) - 1;
+
+		// Takes a slot for the session of the client, a newer session of the same id takes over the lookup by id.
+		// kNoHandle when all the slots of the index bits are taken
+		uint32_t Intern(const std::string& client_id, Session* session);
+
+		// Frees the slot, the handle and every copy of it become stale
+		void Release(uint32_t handle);
+
+		// nullptr if the handle is stale
+		Session* Find(uint32_t handle) const;
+
+		// Handle of the newest session of the client, kNoHandle if there is none
+		uint32_t Lookup(std::string_view client_id) const;
+
+		// The handle must not be stale
+		const std::string& Id(uint32_t handle) const { return entries_[handle & kHandleIndexMask].id; }
+		uint64_t Hash(uint32_t handle) const { return entries_[handle & kHandleIndexMask].hash; }
+
+		size_t Size() const { return ids_.size(); }
+
+	private:
+		struct Entry {
+			std::string id;
+			uint64_t hash = 0;          // of the id, computed once
+			Session* session = nullptr; // nullptr while the slot is free
+			uint32_t generation = 0;
+		};
+
+		// a deque does not move its entries, so the keys of ids_ can point into them
+		std::deque<Entry> entries_;
+		std::vector<uint32_t> free_;
+		std::unordered_map<std::string_view, uint32_t> ids_;
+	};
+
+} // namespace network
+
+#endif
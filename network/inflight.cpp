@@ -0,0 +1,74 @@
+#include "inflight.hpp"
+
+#include <algorithm>
+
+uint16_t network::InflightWindow::Add(shared_bytes packet, std::chrono::steady_clock::time_point now, uint64_t seq) {
+	for (;;) {
+		uint16_t id = next_id_;
+		next_id_ = next_id_ == UINT16_MAX ? 1 : next_id_ + 1;
+
+		Slot& slot = slots_[id % slots_.size()];
+
+		if (slot.state == kFree) {
+			slot.packet = std::move(packet);
+			slot.sent = now;
+			slot.seq = seq;
+			slot.id = id;
+			slot.state = kWaitAck;
+			slot.queued = false;
+			size_++;
+			return id;
+		}
+	}
+}
+
+network::InflightWindow::Slot* network::InflightWindow::Find(uint16_t id) {
+	Slot& slot = slots_[id % slots_.size()];
+
+	if (slot.state == kFree || slot.id != id) {
+		return nullptr;
+	}
+	return &slot;
+}
+
+bool network::InflightWindow::Received(uint16_t id) {
+	Slot* slot = Find(id);
+
+	if (slot == nullptr || slot->state != kWaitAck) {
+		return false;
+	}
+
+	// only PUBREL is sent from now on
+	slot->packet.reset();
+	slot->state = kWaitComp;
+	return true;
+}
+
+bool network::InflightWindow::Complete(uint16_t id, kState state) {
+	Slot* slot = Find(id);
+
+	if (slot == nullptr || slot->state != state) {
+		return false;
+	}
+
+	slot->packet.reset();
+	slot->state = kFree;
+	slot->queued = false;
+	size_--;
+	return true;
+}
+
+void network::InflightWindow::Expired(std::chrono::steady_clock::time_point deadline, std::deque<uint16_t>& ids) {
+	size_t first = ids.size();
+
+	for (Slot& slot : slots_) {
+		if (slot.state != kFree && !slot.queued && slot.sent <= deadline) {
+			slot.queued = true;
+			ids.push_back(slot.id);
+		}
+	}
+
+	std::sort(ids.begin() + first, ids.end(), [this](uint16_t a, uint16_t b) {
+		return Find(a)->sent < Find(b)->sent;
+	});
+}
@@ -0,0 +1,67 @@
+#ifndef MQTT_NETWORK_INFLIGHT_H_
+#define MQTT_NETWORK_INFLIGHT_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "../utility/mqtt.hpp"
+
+namespace network {
+
+	/*
+	*  QoS 1 and 2 messages sent to a client and not acknowledged yet.
+	*  The window has a fixed number of slots and the message with packet id N lives
+	*  in slot N % capacity, so an acknowledgement finds it without a search or an allocation.
+	*  New packet ids go round 1..65535 and skip the ids whose slot is still taken.
+	*/
+	class InflightWindow {
+	public:
+		enum kState {
+			kFree,
+			kWaitAck,  // PUBLISH was sent, waiting for PUBACK or PUBREC
+			kWaitComp  // PUBREL was sent, waiting for PUBCOMP
+		};
+
+		struct Slot {
+			shared_bytes packet; // the shared encoding, kept until the message is delivered
+			std::chrono::steady_clock::time_point sent;
+			uint64_t seq = 0;    // sequence number of the message in the store, 0 if it is not stored
+			uint16_t id = 0;
+			kState state = kFree;
+			bool queued = false; // waits in the retransmission queue
+		};
+
+		explicit InflightWindow(size_t capacity) : slots_(capacity) {}
+
+		size_t Size() const { return size_; }
+		size_t Capacity() const { return slots_.size(); }
+		bool Full() const { return size_ == slots_.size(); }
+		bool Empty() const { return size_ == 0; }
+
+		// Keeps the message under a free packet id and returns the id, the window must not be full
+		uint16_t Add(shared_bytes packet, std::chrono::steady_clock::time_point now, uint64_t seq = 0);
+
+		// nullptr if there is no message with this id in the window
+		Slot* Find(uint16_t id);
+
+		// PUBREC: the message is delivered, the slot waits for PUBCOMP
+		bool Received(uint16_t id);
+
+		// PUBACK or PUBCOMP, the slot is freed if it waited in this state
+		bool Complete(uint16_t id, kState state);
+
+		// Ids of the messages sent before the deadline in the order they were sent
+		void Expired(std::chrono::steady_clock::time_point deadline, std::deque<uint16_t>& ids);
+
+	private:
+		std::vector<Slot> slots_;
+		size_t size_ = 0;
+		uint16_t next_id_ = 1;
+	};
+
+} // namespace network
+
+#endif
@@ -0,0 +1,136 @@
+#include "log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+network::Logger network::logger;
+
+network::Logger::Logger() {
+	for (size_t i = 0; i < kSlots; i++) {
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+network::Logger::~Logger() {
+	Stop();
+}
+
+void network::Logger::Start(const std::string& filename, kMessageType level) {
+	if (running_.load()) {
+		return;
+	}
+
+	file_.open(filename, std::ios::app);
+	SetLevel(level);
+
+	running_.store(true);
+	thread_ = std::thread([this] { Run(); });
+}
+
+void network::Logger::Stop() {
+	if (!running_.exchange(false)) {
+		return;
+	}
+
+	thread_.join();
+	file_.close();
+}
+
+/*
+*  Bounded queue of Dmitry Vyukov.
+*  A slot is free for the producer at position pos when its sequence is pos,
+*  and holds a line for the writer when its sequence is pos + 1.
+*/
+void network::Logger::Push(kMessageType type, unsigned int session_id, std::string_view what) {
+	size_t pos = head_.load(std::memory_order_relaxed);
+	Slot* slot;
+
+	for (;;) {
+		slot = &slots_[pos & (kSlots - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+
+		if (diff == 0) {
+			if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			// the writer is behind by the whole ring
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else {
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->type = type;
+	slot->session_id = session_id;
+	slot->time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	slot->thread = std::this_thread::get_id();
+	slot->len = std::min(what.size(), kMaxLine);
+	std::memcpy(slot->text, what.data(), slot->len);
+
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void network::Logger::Run() {
+	while (running_.load(std::memory_order_acquire)) {
+		if (!Flush()) {
+			std::this_thread::sleep_for(kFlushInterval);
+		}
+	}
+
+	Flush();
+}
+
+bool network::Logger::Flush() {
+	std::ostringstream batch;
+	size_t lines = 0;
+
+	for (;;) {
+		Slot& slot = slots_[tail_ & (kSlots - 1)];
+
+		if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+			break;
+		}
+
+		batch << '\n' << '[' << kEnumToString[slot.type] << ']'
+			  << ' ' << '[' << slot.time << ']'
+			  << ' ' << '[' << slot.thread << ']'
+			  << ' ' << '[' << slot.session_id << ']'
+			  << ' ' << std::string_view(slot.text, slot.len) << '\n';
+
+		slot.sequence.store(tail_ + kSlots, std::memory_order_release);
+		tail_++;
+		lines++;
+	}
+
+	size_t dropped = Dropped();
+	if (dropped != reported_dropped_) {
+		batch << '\n' << '[' << kEnumToString[warning] << ']'
+			  << ' ' << '[' << std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) << ']'
+			  << ' ' << '[' << std::this_thread::get_id() << ']'
+			  << ' ' << '[' << 0 << ']'
+			  << ' ' << dropped - reported_dropped_ << " log lines were dropped, " << dropped << " in total" << '\n';
+
+		reported_dropped_ = dropped;
+		lines++;
+	}
+
+	if (lines == 0) {
+		return false;
+	}
+
+	std::string text = std::move(batch).str();
+
+	file_ << text;
+	file_.flush();
+
+	std::cout << text;
+	std::cout.flush();
+
+	return true;
+}
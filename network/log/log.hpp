@@ -1,55 +1,121 @@
-#ifndef MQTT_UTILITY_LOG_H_
-#define MQTT_UTILITY_LOG_H_
-
-#include <iostream>
-#include <chrono>
-#include <thread>
-#include <fstream>
-
-enum kMessageType {
-	info = 0,
-	debug,
-	warning,
-	error
-};
-
-struct {
-	constexpr std::string_view operator[](kMessageType type) {
-		switch (type)
-		{
-		case info:
-			return "INFO";
-		case debug:
-			return "DEBUG";
-		case warning:
-			return "WARNING";
-		case error:
-			return "ERROR";
-		}
-		return "SOMETHING ELSE";
-	}
-} kEnumToString;
-
-static void Log(std::string file_name, kMessageType type, unsigned int session_id, std::string_view what) {
-
-	auto time_ = std::chrono::system_clock::now();
-	std::time_t time = std::chrono::system_clock::to_time_t(time_);
-	auto th_id = std::this_thread::get_id();
-
-	std::fstream outfile{ file_name, std::ios::app };
-
-	outfile << '\n' << '[' << kEnumToString[type] << ']' << ' ' << '[' << (time) << ']' 
-			<< ' ' << '[' << th_id << ']' 
-			<< ' ' << '[' << session_id << ']' 
-			<< ' ' << what << '\n';
-
-	std::cout << '\n' << '[' << kEnumToString[type] << ']' 
-			  << ' ' << '[' << time << ']' 
-			  << ' ' << '[' << th_id << ']' 
-			  << ' ' << '[' << session_id << ']' 
-			  << ' ' << what << '\n';
-}
-
-#endif 
-
-
+#ifndef MQTT_UTILITY_LOG_H_
+#define MQTT_UTILITY_LOG_H_
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <array>
+#include <atomic>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+// In the order of severity, the level of the logger is the lowest one that is written
+enum kMessageType {
+	debug = 0,
+	info,
+	warning,
+	error
+};
+
+struct EnumToString {
+	constexpr std::string_view operator[](kMessageType type) const {
+		switch (type)
+		{
+		case info:
+			return "INFO";
+		case debug:
+			return "DEBUG";
+		case warning:
+			return "WARNING";
+		case error:
+			return "ERROR";
+		}
+		return "SOMETHING ELSE";
+	}
+};
+
+inline constexpr EnumToString kEnumToString;
+
+namespace network {
+
+	/*
+	*  Logger with a background writer.
+	*  Producers copy the line into a slot of a fixed ring and never wait,
+	*  when the ring is full the line is dropped and counted.
+	*  The writer thread takes the lines out in batches and writes them
+	*  to the log file, which stays open, and to stdout.
+	*/
+	class Logger {
+	public:
+		static constexpr size_t kSlots = 8192; // power of two
+		static constexpr size_t kMaxLine = 224; // longer lines are cut
+		static constexpr auto kFlushInterval = std::chrono::milliseconds(10);
+
+		Logger();
+		~Logger();
+
+		// Opens the file and starts the writer thread, lines logged before are kept
+		void Start(const std::string& filename, kMessageType level);
+
+		// Writes out the lines that are left and stops the writer thread
+		void Stop();
+
+		// Lines below the level are not logged
+		void SetLevel(kMessageType level) { level_.store(level, std::memory_order_relaxed); }
+		bool Enabled(kMessageType type) const { return type >= level_.load(std::memory_order_relaxed); }
+
+		// Can be called from any thread
+		void Push(kMessageType type, unsigned int session_id, std::string_view what);
+
+		size_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+	private:
+		struct Slot {
+			std::atomic<size_t> sequence;
+			kMessageType type;
+			unsigned int session_id;
+			std::time_t time;
+			std::thread::id thread;
+			size_t len;
+			char text[kMaxLine];
+		};
+
+		void Run();
+
+		// Writes all lines that are in the ring, returns false if there were none
+		bool Flush();
+
+		std::array<Slot, kSlots> slots_;
+
+		alignas(64) std::atomic<size_t> head_ = 0;
+		alignas(64) size_t tail_ = 0; // used only by the writer
+
+		std::atomic<size_t> dropped_ = 0;
+		size_t reported_dropped_ = 0;
+
+		std::atomic<kMessageType> level_ = info;
+		std::atomic<bool> running_ = false;
+
+		std::ofstream file_;
+		std::thread thread_;
+	};
+
+	extern Logger logger;
+
+} // namespace network
+
+// Checks the level before a line is built, so disabled lines cost nothing on hot paths
+inline bool LogEnabled(kMessageType type) {
+	return network::logger.Enabled(type);
+}
+
+inline void Log(kMessageType type, unsigned int session_id, std::string_view what) {
+	if (network::logger.Enabled(type)) {
+		network::logger.Push(type, session_id, what);
+	}
+}
+
+#endif
+
@@ -0,0 +1,196 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+	// only the thread of the shard writes, so there is no read-modify-write
+	void Bump(std::atomic<uint64_t>& value, uint64_t n) {
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	const char* const kCounterNames[network::kCounterSize] = {
+		"messages_received",
+		"messages_sent",
+		"bytes_received",
+		"bytes_sent",
+		"messages_dropped",
+		"connects",
+		"disconnects",
+		"messages_queued",
+		"messages_inflight",
+		"subscriptions",
+		"connects_waiting"
+	};
+
+} // namespace
+
+const char* network::CounterName(kCounter counter) {
+	return counter < kCounterSize ? kCounterNames[counter] : "unknown";
+}
+
+void network::LatencySnapshot::Subtract(const LatencySnapshot& earlier) {
+	for (size_t i = 0; i < counts.size(); i++) {
+		counts[i] -= std::min(counts[i], earlier.counts[i]);
+	}
+	count -= std::min(count, earlier.count);
+	sum -= std::min(sum, earlier.sum);
+}
+
+uint64_t network::LatencySnapshot::Percentile(double p) const {
+	return LatencyLayout::PercentileOf(counts, count, p, 0, max);
+}
+
+void network::LatencyHistogram::Record(std::chrono::steady_clock::duration latency) {
+	uint64_t ns = uint64_t(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+
+	Bump(counts_[LatencyLayout::Index(ns)], 1);
+	Bump(count_, 1);
+	Bump(sum_, ns);
+
+	if (ns > max_.load(std::memory_order_relaxed)) {
+		max_.store(ns, std::memory_order_relaxed);
+	}
+}
+
+void network::LatencyHistogram::AddTo(LatencySnapshot& snapshot) const {
+	for (size_t i = 0; i < counts_.size(); i++) {
+		snapshot.counts[i] += counts_[i].load(std::memory_order_relaxed);
+	}
+	snapshot.count += count_.load(std::memory_order_relaxed);
+	snapshot.sum += sum_.load(std::memory_order_relaxed);
+	snapshot.max = std::max(snapshot.max, max_.load(std::memory_order_relaxed));
+}
+
+void network::MetricsSnapshot::Add(const ShardMetrics& shard) {
+	for (size_t i = 0; i < counters.size(); i++) {
+		counters[i] += shard.counters[i].Get();
+	}
+	shard.route.AddTo(route);
+	shard.write.AddTo(write);
+}
+
+std::string network::MetricsSnapshot::Format() const {
+	std::string text;
+
+	auto line = [&](const std::string& name, uint64_t value) {
+		text += name;
+		text += ' ';
+		text += std::to_string(value);
+		text += '\n';
+	};
+
+	line("uptime_seconds", uint64_t(std::chrono::duration_cast<std::chrono::seconds>(uptime).count()));
+	line("sessions", sessions);
+	line("heap_bytes", heap);
+	line("clients_connected", uint64_t(std::max<int64_t>(0, counters[kConnects] - counters[kDisconnects])));
+
+	for (size_t i = 0; i < counters.size(); i++) {
+		line(CounterName(kCounter(i)), uint64_t(std::max<int64_t>(0, counters[i])));
+	}
+
+	for (auto [name, latency] : { std::pair{ "route", &route }, std::pair{ "write", &write } }) {
+		std::string prefix = std::string("latency_") + name + "_";
+
+		line(prefix + "count", latency->count);
+		line(prefix + "mean_us", latency->Mean() / 1000);
+		line(prefix + "p50_us", latency->Percentile(0.5) / 1000);
+		line(prefix + "p99_us", latency->Percentile(0.99) / 1000);
+		line(prefix + "p999_us", latency->Percentile(0.999) / 1000);
+		line(prefix + "max_us", latency->max / 1000);
+	}
+
+	return text;
+}
+
+void network::LoadAverage::Update(int64_t total, std::chrono::steady_clock::duration elapsed) {
+	double seconds = std::chrono::duration<double>(elapsed).count();
+
+	if (seconds <= 0) {
+		return;
+	}
+
+	double per_minute = double(total - last_) * 60.0 / seconds;
+	last_ = total;
+
+	constexpr std::array<double, 3> kWindows = { 60.0, 300.0, 900.0 };
+
+	for (size_t i = 0; i < values_.size(); i++) {
+		double decay = std::exp(-seconds / kWindows[i]);
+		values_[i] = values_[i] * decay + per_minute * (1.0 - decay);
+	}
+}
+
+const std::vector<std::pair<std::string, std::string>>& network::SysTopics::Update(const MetricsSnapshot& current) {
+	std::chrono::steady_clock::duration elapsed = current.uptime - last_.uptime;
+	int64_t connected = std::max<int64_t>(0, current.counters[kConnects] - current.counters[kDisconnects]);
+
+	clients_maximum_ = std::max(clients_maximum_, connected);
+	heap_maximum_ = std::max(heap_maximum_, current.heap);
+
+	const std::array<kCounter, 5> loaded = { kMessagesIn, kMessagesOut, kBytesIn, kBytesOut, kConnects };
+	const std::array<const char*, 5> load_names = { "messages/received", "messages/sent", "bytes/received", "bytes/sent", "connections" };
+
+	for (size_t i = 0; i < loads_.size(); i++) {
+		loads_[i].Update(current.counters[loaded[i]], elapsed);
+	}
+
+	LatencySnapshot route = current.route;
+	LatencySnapshot write = current.write;
+	route.Subtract(last_.route);
+	write.Subtract(last_.write);
+
+	topics_.clear();
+
+	auto topic = [&](const std::string& name, std::string value) {
+		topics_.emplace_back("$SYS/broker/" + name, std::move(value));
+	};
+
+	auto number = [&](const std::string& name, int64_t value) {
+		topic(name, std::to_string(std::max<int64_t>(0, value)));
+	};
+
+	topic("uptime", std::to_string(std::chrono::duration_cast<std::chrono::seconds>(current.uptime).count()) + " seconds");
+	number("clients/total", int64_t(current.sessions));
+	number("clients/connected", connected);
+	number("clients/maximum", clients_maximum_);
+	number("messages/received", current.counters[kMessagesIn]);
+	number("messages/sent", current.counters[kMessagesOut]);
+	number("messages/dropped", current.counters[kMessagesDropped]);
+	number("messages/queued", current.counters[kQueuedMessages]);
+	number("messages/inflight", current.counters[kInflightMessages]);
+	number("publish/messages/received", current.counters[kMessagesIn]);
+	number("publish/messages/sent", current.counters[kMessagesOut]);
+	number("publish/messages/dropped", current.counters[kMessagesDropped]);
+	number("bytes/received", current.counters[kBytesIn]);
+	number("bytes/sent", current.counters[kBytesOut]);
+	number("subscriptions/count", current.counters[kSubscriptions]);
+
+	if (current.heap != 0) {
+		number("heap/current", int64_t(current.heap));
+		number("heap/maximum", int64_t(heap_maximum_));
+	}
+
+	const std::array<const char*, 3> windows = { "1min", "5min", "15min" };
+
+	for (size_t i = 0; i < loads_.size(); i++) {
+		for (size_t w = 0; w < 3; w++) {
+			char value[32];
+			std::snprintf(value, sizeof(value), "%.2f", loads_[i].Values()[w]);
+			topic(std::string("load/") + load_names[i] + '/' + windows[w], value);
+		}
+	}
+
+	// microseconds over the last interval
+	number("latency/route/p50", int64_t(route.Percentile(0.5) / 1000));
+	number("latency/route/p99", int64_t(route.Percentile(0.99) / 1000));
+	number("latency/route/max", int64_t(route.Percentile(1.0) / 1000));
+	number("latency/write/p50", int64_t(write.Percentile(0.5) / 1000));
+	number("latency/write/p99", int64_t(write.Percentile(0.99) / 1000));
+	number("latency/write/max", int64_t(write.Percentile(1.0) / 1000));
+
+	last_ = current;
+	return topics_;
+}
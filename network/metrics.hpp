@@ -0,0 +1,145 @@
+#ifndef MQTT_NETWORK_METRICS_H_
+#define MQTT_NETWORK_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../utility/histogram.hpp"
+
+namespace network {
+
+	enum kCounter {
+		kMessagesIn,       // PUBLISH received from clients
+		kMessagesOut,      // PUBLISH written to sockets, retransmissions are not counted
+		kBytesIn,
+		kBytesOut,
+		kMessagesDropped,  // by the limits of the outgoing queues
+		kConnects,         // CONNACK sent
+		kDisconnects,      // connections of clients closed
+		kQueuedMessages,   // gauge, messages in the outgoing queues
+		kInflightMessages, // gauge, QoS 1 and 2 messages sent and not acknowledged
+		kSubscriptions,    // gauge
+		kConnectsWaiting,  // gauge, CONNECT packets held back by the connect rate
+		kCounterSize
+	};
+
+	const char* CounterName(kCounter counter);
+
+	/*
+	*  A counter is written only by the thread of its shard, so adding is a plain load and store
+	*  without a locked instruction and other threads may read it at any time.
+	*  A gauge is a counter that goes down as well, its sum over the shards is the current value
+	*/
+	class Counter {
+	public:
+		void Add(int64_t n) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+		int64_t Get() const { return value_.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<int64_t> value_ = 0;
+	};
+
+	// Every power of two of nanoseconds is split into 8 buckets, the error is below 12.5%
+	typedef stats::Histogram<3> LatencyLayout;
+	constexpr size_t kLatencyBuckets = LatencyLayout::kBuckets;
+
+	// Latencies of a histogram summed over the shards
+	struct LatencySnapshot {
+		std::array<uint64_t, kLatencyBuckets> counts{};
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+
+		// Keeps only what was recorded after the earlier snapshot, max stays the maximum since the start
+		void Subtract(const LatencySnapshot& earlier);
+
+		// Nanoseconds below which the fraction p of the recorded latencies lie, p is in [0, 1]
+		uint64_t Percentile(double p) const;
+		uint64_t Mean() const { return count == 0 ? 0 : sum / count; }
+	};
+
+	// Histogram of one shard, written by its thread like a counter
+	class LatencyHistogram {
+	public:
+		void Record(std::chrono::steady_clock::duration latency);
+		void AddTo(LatencySnapshot& snapshot) const;
+
+	private:
+		std::array<std::atomic<uint64_t>, kLatencyBuckets> counts_{};
+		std::atomic<uint64_t> count_ = 0;
+		std::atomic<uint64_t> sum_ = 0;
+		std::atomic<uint64_t> max_ = 0;
+	};
+
+	/*
+	*  Metrics of one shard. It starts at a cache line of its own and fills whole lines,
+	*  so the counters of different threads never share a line
+	*/
+	struct alignas(64) ShardMetrics {
+		std::array<Counter, kCounterSize> counters;
+		LatencyHistogram route; // received -> in the queues of the subscribers of the shard
+		LatencyHistogram write; // queued -> written to the socket
+
+		void Add(kCounter counter, int64_t n = 1) { counters[counter].Add(n); }
+	};
+
+	// Counters of one session, used only by the thread of its shard
+	struct SessionMetrics {
+		uint64_t messages_in = 0;
+		uint64_t messages_out = 0;
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+	};
+
+	// Metrics of the whole broker, the shards are summed only when somebody asks for them
+	struct MetricsSnapshot {
+		std::array<int64_t, kCounterSize> counters{};
+		LatencySnapshot route;
+		LatencySnapshot write;
+		size_t sessions = 0;
+		size_t heap = 0; // bytes in use by malloc, 0 where it can not be asked
+		std::chrono::steady_clock::duration uptime{ 0 };
+
+		void Add(const ShardMetrics& shard);
+
+		// "name value" lines, latencies are in microseconds
+		std::string Format() const;
+	};
+
+	// Average per minute over the last 1, 5 and 15 minutes of a growing counter, like the load of mosquitto
+	class LoadAverage {
+	public:
+		void Update(int64_t total, std::chrono::steady_clock::duration elapsed);
+		const std::array<double, 3>& Values() const { return values_; }
+
+	private:
+		int64_t last_ = 0;
+		std::array<double, 3> values_{};
+	};
+
+	/*
+	*  Topics under $SYS/broker/ with their values, named like the ones of mosquitto.
+	*  Update takes the metrics at every tick of the timer, the loads and the latencies
+	*  are computed from the difference to the previous tick
+	*/
+	class SysTopics {
+	public:
+		const std::vector<std::pair<std::string, std::string>>& Update(const MetricsSnapshot& current);
+
+	private:
+		MetricsSnapshot last_;
+		std::array<LoadAverage, 5> loads_;
+		int64_t clients_maximum_ = 0;
+		size_t heap_maximum_ = 0;
+		std::vector<std::pair<std::string, std::string>> topics_;
+	};
+
+} // namespace network
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MQTT_NETWORK_MPSC_QUEUE_H_
+#define MQTT_NETWORK_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace network {
+
+	/*
+	*  Lock-free queue with many producers and a single consumer.
+	*  Producers only exchange the head pointer, so Push never waits for other threads.
+	*  Pop may return false while a producer is in the middle of Push,
+	*  that producer wakes up the consumer itself once the element is linked.
+	*/
+	template<class T>
+	class MpscQueue {
+	public:
+		MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		~MpscQueue() {
+			T value;
+			while (Pop(value)) {}
+		}
+
+		// Can be called from any thread
+		void Push(T value) {
+			Link(new Node{ std::move(value) });
+		}
+
+		// Must be called only from the consumer thread
+		bool Pop(T& value) {
+			Node* tail = tail_;
+			Node* next = tail->next.load(std::memory_order_acquire);
+
+			// skipping the stub node
+			if (tail == &stub_) {
+				if (next == nullptr) {
+					return false;
+				}
+				tail_ = next;
+				tail = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+
+			if (next != nullptr) {
+				return Take(tail, next, value);
+			}
+
+			// a producer has swapped the head but has not linked its node yet
+			if (tail != head_.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			// the last node can only be taken when there is a node after it
+			Link(&stub_);
+			next = tail->next.load(std::memory_order_acquire);
+
+			if (next != nullptr) {
+				return Take(tail, next, value);
+			}
+			return false;
+		}
+
+	private:
+		struct Node {
+			T value;
+			std::atomic<Node*> next = nullptr;
+		};
+
+		void Link(Node* node) {
+			node->next.store(nullptr, std::memory_order_relaxed);
+			Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+			prev->next.store(node, std::memory_order_release);
+		}
+
+		bool Take(Node* tail, Node* next, T& value) {
+			tail_ = next;
+			value = std::move(tail->value);
+			delete tail;
+			return true;
+		}
+
+		Node stub_;
+		std::atomic<Node*> head_;
+		Node* tail_;
+	};
+
+} // namespace network
+
+#endif
@@ -1,710 +1,1976 @@
-
-#include "server.hpp"
-
-asio::awaitable<void> network::Server::Listen(tcp::acceptor acceptor, std::string filename) {
-
-	unsigned int id_of_session = 1;
-	server.filename_ = std::move(filename);
-	for(;;) {
-		Log(server.filename_, info, 0, "Start Listen");
-		bool b = true;
-
-		auto sock = co_await acceptor.async_accept(asio::use_awaitable);
-
-		// Checking if there is a free session
-		for(auto session : server.sessions_) {
-			if(session->SessionIsFree()) { //Checking
-				session->TransferControl(std::move(sock));
-				b = false; // Setting a special variable to false
-				break;
-			}
-		}
-
-		// If the special variable is true, then create a new session
-		if(b) {
-			server.sessions_.push_back(std::make_shared<Session>(std::move(sock), id_of_session));
-			server.sessions_.back()->Start();
-		}
-
-		id_of_session++;
-	}
-}
-
-// Using this function, you can send a message to the user with the specified id
-void network::Server::SendMessageTo(std::string id, uint8_t* msg, size_t len_of_msg) {
-	auto user = sessions_.begin();
-
-	//looking for a session with the specified id
-	for(; user != end(sessions_); user++) {
-		if (user->get()->GetId() == id) {
-			break;
-		}
-	}
-	
-	if (user != end(sessions_)) {
-		user->get()->RewriteBuffer(msg, len_of_msg);
-	}
-}
-
-// This function returns a smart pointer to the session
-std::shared_ptr<network::Session> network::Server::GetSession(std::string& client_id) {
-	for(auto session : sessions_) {
-		if(session->GetId() == client_id) {
-			return session;
-		}
-	}
-	return nullptr;
-}
-
-
-/*
-*  This is one of the most important functions.
-*  A packet with the received data is sent to her 
-*  and she processes it by calling special functions and handlers
-*/
-int network::Session::PacketHandler(uint8_t* packet)
-{
-	mqtt::packet pack;
-	mqtt::Header head;
-	head.bits = packet[0];
-	head.remaining_length = packet[1];
-
-	int rc = -SHOULD_SEND;
-
-	try {
-		switch (packet[0] >> 4) // Checking the package type
-			/*
-			*  First, in each case, the pack variable is initialized by the type of package we received. 
-			*  Next, a function of the Unpack type is called, which moves data to the package object. 
-			*  At the end, the corresponding handler is called for the package
-			*/
-		{
-		case CONNECT:
-		{
-
-			pack = mqtt::Connect();
-			mqtt::Connect con = std::move(std::get<2>(pack));
-
-			mqtt::UnpackConnect(packet, &head, &con);
-
-			rc = ConnectHandler(&con);
-			break;
-		}
-		case PUBLISH: {
-			pack = mqtt::Publish();
-			mqtt::Publish pub = std::move(std::get<5>(pack));
-
-			mqtt::UnpackPublish(packet, &head, &pub);
-			rc = PublishHandler(&pub);
-			break;
-		}
-
-		case SUBSCRIBE: {
-
-			pack = mqtt::Subscribe();
-			mqtt::Subscribe sub = std::move(std::get<6>(pack));
-
-			long error = mqtt::UnpackSubscribe(packet, &head, &sub);
-
-			if(error == -1) {
-				Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-				Stop();
-				break;
-			}
-
-			rc = SubscribeHandler(&sub);
-			break;
-		}
-
-		case UNSUBSCRIBE: {
-			pack = mqtt::Unsubscribe();
-
-			mqtt::Unsubscribe unsub = std::move(std::get<7>(pack));
-			mqtt::UnpackUnsubscribe(packet, &head, &unsub);
-			rc = UnsubscribeHandler(&unsub);
-			break;
-		}
-
-		case DISCONNECT: {
-			rc = DisconnectHandler();
-			break;
-		}
-		case PINGREQ: {
-			if((head.bits & 0x0F) != 0) {
-				Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-				Stop();
-			}
-			rc = PingreqHandler();
-			break;
-		}
-		default:
-			pack = mqtt::AckPacket();
-			mqtt::AckPacket ack_packet = std::move(std::get<0>(pack));
-			mqtt::UnpackAck(packet, &head, &ack_packet);
-
-			switch (packet[0] >> 4)
-			{
-			case PUBACK:
-				rc = -SHOULD_SEND;
-				break;
-			case PUBREC:
-
-				rc = PubrecHandler(&ack_packet);
-				break;
-			case PUBREL:
-				rc = PubrelHandler(&ack_packet);
-				break;
-			}
-		}
-	}
-	catch (std::exception& ex) {
-		Log(server.GetFilename(), error, id_of_session_,
-			"An error occurred while processing the package: " + std::string(ex.what()));
-	}
-
-	return rc;
-}
-
-network::Session::Session(tcp::socket sock, unsigned int id_of_session)
-	: sock_(std::move(sock)), timer_for_send(sock_.get_executor()), 
-	  timer_for_ping(sock_.get_executor()), id_of_session_(id_of_session), session_is_available(false) 
-{
-	timer_for_send.expires_at(std::chrono::steady_clock::time_point::max());
-	std::fill(begin(buf_), end(buf_), 0);
-}
-
-// Coroutines are initialized in this function
-void network::Session::Start() {
-	asio::co_spawn(sock_.get_executor(), ReadBytes(), asio::detached);
-	asio::co_spawn(sock_.get_executor(), SendBytes(), asio::detached);
-}
-
-/*
-* This function overwrites the data in the buffer
-* This is only used in the SendMessageTo function
-*/
-void network::Session::RewriteBuffer(uint8_t* buf, size_t len_of_msg)
-{
-	std::fill(begin(buf_), end(buf_), 0);
-	std::vector<uint8_t> buf1(len_of_msg);
-
-	for(int i = 0; i < len_of_msg; ++i) {
-		buf1[i] = buf[i];
-	}
-
-	packets_.push(buf1);
-
-
-	timer_for_send.cancel_one();
-}
-
-std::string network::Session::GetId() {
-	return cl.client_id_;
-}
-
-unsigned int network::Session::GetSessionId() {
-	return id_of_session_;
-}
-
-// This function gives control to some session
-void network::Session::TransferControl(tcp::socket sock) {
-	sock_ = std::move(sock);
-	session_is_available = false;
-	this->Start();
-
-	Log(server.GetFilename(), info, id_of_session_, "We have transferred control to this session");
-}
-
-
-// This is a special handler that is called only if the Clear Session bit in the CONNECT packet is 0
-void network::Session::CleanSessionHandler() {
-
-	//before the session is fully restored, you need to send a CONNACK package
-	mqtt::Connack answer;
-
-	answer = std::move(mqtt::PacketConnack(CONNACK_BYTE, 1, 0));
-
-	uint8_ptr ptr = std::move(mqtt::PackConnack(&answer));
-
-	len_of_packet_ = 4;
-	should_send_ = true;
-
-	std::vector<uint8_t> buf(len_of_packet_);
-
-	for (int i = 0; i < 4; i++) {
-		buf[i] = ptr.get()[i];
-	}
-
-	
-	//sock_.write_some(asio::buffer(buf, len_of_packet_));  //TODO
-
-	//Now we restore the contents of the variablesand the buffer
-
-	packets_.push(buf);
-
-	timer_for_send.cancel_one();
-}
-
-bool network::Session::SessionIsFree() {
-	return session_is_available;
-}
-
-
-/* 
-*  This function sends WillMessage when the user disconnects from the server. 
-*  First, it generates publish for each WillTopic subscriber. 
-*  At the end, it sends the packet to the subscriber.
-*/
-void network::Session::SendWillMessage() {
-	if (cl.connect_flags_ & 0x4) {
-		mqtt::Publish pub;
-		mqtt::Header header;
-
-		header.bits = (((cl.connect_flags_ & 0x18) >> 2u) | 0x30);
-		size_t packet_len = 4;
-		packet_len += cl.will_msg_.size();
-		packet_len += cl.will_topic_.size();
-		
-		if((cl.connect_flags_ & 0x18) > 0) {
-			packet_len += 2;
-		}
-
-		std::vector<uint8_t> buf(packet_len);
-		size_t step = 0;
-
-		buf[step] = header.bits;
-		step += 2;
-
-		packet_len -= 2;
-		mqtt::EncodeLength(buf.data() + 1, packet_len);
-		header.remaining_length = buf[1];
-
-		buf[step] = (cl.will_topic_.size() >> 8u);
-		step++;
-
-		buf[step] = (cl.will_topic_.size());
-		step++;
-		
-		for(char ch : cl.will_topic_) {
-			buf[step] = ch;
-			step++;
-		}
-
-		if(cl.connect_flags_ & 0x18) {
-			buf[step] = 0x00;
-			step++;
-			buf[step] = 0x01;
-			step++;
-		}
-
-		for(char ch : cl.will_msg_) {
-			buf[step] = ch;
-			step++;
-		}
-
-		mqtt::UnpackPublish(buf.data(), &header, &pub);
-		PublishHandler(&pub);
-
-		Log(server.GetFilename(), info, id_of_session_,
-			"Sent WillMessage for subscribers of " + pub.topic);
-	}
-}
-
-/*
-*  This coroutine is responsible for reading the data. 
-*  It also analyzes the package for errors
-*/
-asio::awaitable<void> network::Session::ReadBytes() {
-
-	try{
-		for (;;) {
-
-			co_await sock_.async_read_some(asio::buffer(buf_, 2), asio::use_awaitable);
-
-			int pack_type = buf_[0] >> 4u;
-			if (pack_type < CONNECT || pack_type > DISCONNECT) {
-				std::stringstream ss;
-				ss << std::hex << buf_[0];
-				Log(server.GetFilename(), error, id_of_session_, "There is no package with this type: 0x" + ss.str());
-				Stop();
-				continue;
-			}
-
-			size_t tlen = mqtt::DecodeLength(buf_.data() + 1);
-
-			if (tlen > MAX_PACKET_LEN) {
-				Log(server.GetFilename(), error, id_of_session_, "The package is too big");
-				std::fill(begin(buf_), end(buf_), 0);
-				continue;
-			}
-
-			if (co_await sock_.async_read_some(asio::buffer(buf_.data() + 2, tlen), asio::use_awaitable) < 0) {
-				Log(server.GetFilename(), error, id_of_session_, "Variable header not received");
-				Stop();
-				continue;
-			}
-
-			Log(server.GetFilename(), info, id_of_session_, 
-				"The package was successfully received. PACKET TYPE: " + std::to_string(int(pack_type)));
-
-			int rc = PacketHandler(buf_.data());
-
-			if (rc == SHOULD_SEND) {
-				should_send_ = true;
-				timer_for_send.cancel_one();
-			}
-			
-		}
-	}
-	catch (std::exception&) {
-		Log(server.GetFilename(), error, id_of_session_, "error during reading");
-	}
-	
-}
-
-/*
-*  This coroutine sends data. 
-*  These are all packages that have not been sent before
-*/
-asio::awaitable<void> network::Session::SendBytes() {
-	try {
-		for (;;) {
-
-			if (!should_send_) {
-				boost::system::error_code ec;
-				co_await timer_for_send.async_wait(asio::redirect_error(asio::use_awaitable, ec));
-			}
-			else {
-				while(!packets_.empty()) {
-					if (co_await sock_.async_write_some(asio::buffer(packets_.front()), asio::use_awaitable) <= 0) {
-	
-						Log(server.GetFilename(), error, id_of_session_, "The package was not sent");
-					}
-					packets_.pop();
-				}
-				len_of_packet_ = 0;
-				should_send_ = false;
-			}
-		}
-	}
-	catch (std::exception&) {
-		Log(server.GetFilename(), error, id_of_session_, "error during sending");
-	}
-}
-
-void network::Session::Stop(bool delete_session) {
-	if (sock_.is_open()) {
-
-		sock_.shutdown(tcp::socket::shutdown_both);
-		sock_.close();
-		Log(server.GetFilename(), info, id_of_session_, "The session was over");
-		timer_for_send.cancel();
-		curiosity.clients_.erase(cl.client_id_); //delete user from database
-
-		SendWillMessage();
-
-
-		//delete all user subscriptions
-		for (const std::string& topic : curiosity.clients_[cl.client_id_]) {
-			std::list<std::shared_ptr<Subscriber>> subs = curiosity.topics_.get(topic);
-
-			for (std::shared_ptr<Subscriber> sub : subs) {
-				if (sub->client_id == cl.client_id_) {
-					subs.remove(sub);
-					break;
-				}
-			}
-		}
-		
-		auto it = curiosity.clients_.find(cl.client_id_);
-		curiosity.clients_.erase(it);
-
-		for(auto& [a, b] : curiosity.clients_) {
-			std::cout << a << '\n';
-		}
-
-		cl.client_id_.clear();
-		cl.connect_flags_ = 0x0;
-		cl.password_.clear();
-		cl.username_.clear();
-		cl.will_msg_.clear();
-		cl.will_topic_.clear();
-	}
-}
-
-network::Session::~Session() {
-} 
-
-int network::Session::ConnectHandler(mqtt::Connect* pkt) {
-
-	if((pkt->header.bits & 0x0F) != 0) {
-		Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-		Stop();
-		return -SHOULD_SEND;
-	}
-
-	if(pkt->payload.cliend_id.empty()) {
-		Log(server.GetFilename(), debug, id_of_session_, "Client Id is empty");
-		Stop();
-		return -SHOULD_SEND;
-	}
-
-	if((pkt->variable_header.connect_flags & 0x1) != 0) {
-		Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-		Stop();
-		return -SHOULD_SEND;
-	}
-
-	
-	if ((pkt->variable_header.connect_flags & 0x2) == 0) {
-		auto session = server.GetSession(pkt->payload.cliend_id);
-
-		//We must restore the connection
-		if (session != nullptr) {
-			std::cout << sock_.is_open() << '\n';
-			session->TransferControl(std::move(sock_));
-			session->CleanSessionHandler();
-			session_is_available = true;
-			Stop();
-			return -SHOULD_SEND;
-		}
-	}
-
-	if (curiosity.clients_.find(pkt->payload.cliend_id) != curiosity.clients_.end()
-		 && (pkt->variable_header.connect_flags & 0x2) == 1) {
-		Log(server.GetFilename(), debug, id_of_session_, "Double connection: " + pkt->payload.cliend_id);
-		Stop();
-		return -SHOULD_SEND;
-	}
-	
-
-	std::fill(begin(buf_), end(buf_), 0);
-	std::vector<uint8_t> buf;
-
-	cl.client_id_ = pkt->payload.cliend_id;
-	cl.connect_flags_ = pkt->variable_header.connect_flags;
-	cl.password_ = pkt->payload.password;
-	cl.username_ = pkt->payload.username;
-	cl.will_msg_ = pkt->payload.will_message;
-	cl.will_topic_ = pkt->payload.will_topic;
-	cl.keepalive_ = pkt->variable_header.keepalive;
-
-	timer_for_ping.expires_after(std::chrono::seconds(cl.keepalive_ * 2));
-	timer_for_ping.async_wait([&](const boost::system::error_code &ec) { 
-		if (!(ec == asio::error::operation_aborted)) {
-			this->Stop();
-		}
-		});
-	timer_for_ping.cancel();
-	curiosity.clients_[cl.client_id_] = {};
-
-	//make CONNACK packet
-	mqtt::Connack answer;
-	
-	answer = std::move(mqtt::PacketConnack(CONNACK_BYTE, 0, 0));
-
-	uint8_ptr ptr = std::move(mqtt::PackConnack(&answer));
-
-	for(int i = 0; i < 4; i++) {
-		buf.push_back(ptr.get()[i]);
-	}
-	buf.resize(4);
-	len_of_packet_ = 4;
-	packets_.push(buf);
-	
-	return SHOULD_SEND;
-}
-
-int network::Session::DisconnectHandler() {
-	Stop();
-	session_is_available = true;
-	return -SHOULD_SEND; 
-}
-
-int network::Session::SubscribeHandler(mqtt::Subscribe* ptr) {
-	
-	if ((ptr->header.bits & 0xF) != 2) {
-		Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-		Stop();
-	}
-
-	std::vector<uint8_t> rcs;
-
-	for (auto& [topic, qos] : ptr->topic_and_qos) {
-		Log(server.GetFilename(), info, id_of_session_,
-			"The user (" + cl.client_id_ + ") subscribed " + "[ Topic: " + topic + " Qos: " + std::to_string(qos) + "]");
-		rcs.push_back(qos);
-
-		size_t topic_len = topic.length();
-		topic_len--;
-
-		if ((topic[topic_len] == '#') && (topic[--topic_len] == '/')) {
-
-			//get a topic without a special sign
-			const std::string& top = topic.substr(0, topic_len);
-
-
-			// the first template parameter is a topic, and the second is a subtree that is below this topic
-			std::map<std::string, subscriptions_tree>* tops = curiosity.topics_.get_node(top);
-
-			
-			for (const auto& [piece_of_topic, tree] : *tops) {
-
-				curiosity.topics_.get(top + "/" + piece_of_topic).push_back(std::make_shared<Subscriber>(qos, cl.client_id_));
-				curiosity.clients_[cl.client_id_].push_back(top + "/" + piece_of_topic);
-			}
-
-		}
-		else {
-			curiosity.topics_.get(topic).push_back(std::make_shared<Subscriber>(qos, cl.client_id_));
-			curiosity.clients_[cl.client_id_].push_back(topic);
-		}
-	}
-
-	//create SUBACK
-	mqtt::Suback sub = std::move(mqtt::PacketSuback(SUBACK_BYTE, ptr->pkt_id, rcs.size(), rcs.data()));
-
-	uint8_ptr pkt = std::move(mqtt::PackSuback(&sub));
-
-	std::fill(begin(buf_), end(buf_), 0);
-
-	len_of_packet_ = 4;
-	len_of_packet_ += ptr->topic_and_qos.size();
-
-	std::vector<uint8_t> buf(len_of_packet_);
-
-	for (int i = 0; i < len_of_packet_; i++) {
-		buf[i] = pkt.get()[i];
-	}
-	packets_.push(buf);
-
-	return SHOULD_SEND;
-}
-
-int network::Session::UnsubscribeHandler(mqtt::Unsubscribe* ptr) {
-
-	if((ptr->header.bits & 0x0F) != 2) {
-		Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-		Stop();
-	}
-
-	//unsubscribe from the specified topics
-	for (auto topic : ptr->topics) {
-
-		auto &subs = curiosity.topics_.get(topic);
-
-		auto it = std::remove_if(begin(subs), end(subs), [&](std::shared_ptr<Subscriber> user) {
-			return user->client_id == cl.client_id_; 
-			});
-
-		if(it != subs.end()) 
-			subs.erase(it);
-	}
-
-	//create UNSUBACK
-	mqtt::Unsuback unsub = std::move(mqtt::PacketAck(UNSUBACK_BYTE, ptr->pkt_id));
-	uint8_ptr pkt = std::move(mqtt::PackAck(&unsub));
-
-	std::vector<uint8_t> buf(4);
-
-	for (int i = 0; i < 4; i++) {
-		buf[i] = pkt.get()[i];
-	}
-	packets_.push(buf);
-
-	return SHOULD_SEND;
-}
-
-int network::Session::PublishHandler(mqtt::Publish* ptr) {
-
-	uint16_t qos = ptr->header.bits & 0xF9;
-
-
-	for(auto &subscriber : curiosity.topics_.get(ptr->topic)) {
-
-		//create PUBLISH
-		ptr->header.bits &= 0xF9;
-		ptr->header.bits |= (subscriber->qos << 1u);
-		uint8_ptr pkt = mqtt::PackPublish(ptr);
-
-		size_t packet_len = subscriber->qos == 0 ? 4 : 6;
-		packet_len += ptr->payload.length();
-		packet_len += ptr->topic.size();
-
-		for (int i = 0; i < packet_len; ++i) {
-			buf_[i] = pkt.get()[i];
-		}
-
-		//send PUBLISH to subscriber
-		server.SendMessageTo(subscriber->client_id, buf_.data(), packet_len);
-	}
-	
-	return -SHOULD_SEND;
-}
-
-int network::Session::PubrecHandler(mqtt::Pubrec* ptr) {
-	
-	if((ptr->header.bits & 0x0F) != 0) {
-		Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-		Stop();
-	}
-
-	//create PUBREL
-	mqtt::Pubrel pub = std::move(mqtt::PacketAck(PUBREL_BYTE, ptr->pkt_id));
-	uint8_ptr pkt = std::move(mqtt::PackAck(&pub));
-
-	std::fill(begin(buf_), end(buf_), 0);
-
-	std::vector<uint8_t> buf(4);
-
-	for(int i = 0; i < 4; i++) {
-		buf[i] = pkt.get()[i];
-	}
-
-	packets_.push(buf);
-
-	should_send_ = true;
-	len_of_packet_ = 4;
-	
-	return SHOULD_SEND;
-}
-
-int network::Session::PubrelHandler(mqtt::Pubrel* ptr) {
-	
-	//create PUBCOMP
-	if ((ptr->header.bits & 0x0F) != 2) {
-		Log(server.GetFilename(), debug, id_of_session_, "The value of the reserved bit is incorrect");
-		Stop();
-	}
-
-	mqtt::Pubcomp pub = std::move(mqtt::PacketAck(PUBCOMP_BYTE, ptr->pkt_id));
-	uint8_ptr pkt = std::move(mqtt::PackAck(&pub));
-
-	std::vector<uint8_t> buf(4);
-
-	for(int i = 0; i < 4; i++) {
-		buf[i] = pkt.get()[i];
-	}
-	packets_.push(buf);
-
-	return SHOULD_SEND;
-}
-
-int network::Session::PingreqHandler() {
-
-	timer_for_ping.cancel();
-	timer_for_ping.expires_after(std::chrono::seconds(cl.keepalive_ * 2));
-
-	timer_for_ping.async_wait([&](const boost::system::error_code& ec) {
-		if (!(ec == asio::error::operation_aborted)) {
-		this->Stop();
-	}});
-
-	std::fill(begin(buf_), end(buf_), 0);
-	std::vector<uint8_t> buf(2);
-	buf[0] = PINGRESP_BYTE;
-	buf[1] = 0;
-	len_of_packet_ = 2;
-	packets_.push(buf);
-	return SHOULD_SEND;
-}
+
+#include "server.hpp"
+
+#if defined(__GLIBC__)
+#include <malloc.h> // mallinfo2 for the heap in $SYS
+#endif
+
+network::Server network::server;
+
+void network::Server::Init(size_t threads) {
+	for (size_t i = 0; i < threads; i++) {
+		shards_.push_back(std::make_unique<Shard>(i));
+	}
+	started_ = std::chrono::steady_clock::now();
+}
+
+void network::Server::Run() {
+	std::vector<std::thread> threads;
+
+	for (size_t i = 1; i < shards_.size(); i++) {
+		threads.emplace_back([this, i] {
+			auto work = asio::make_work_guard(shards_[i]->io);
+			shards_[i]->io.run();
+		});
+	}
+
+	auto work = asio::make_work_guard(shards_[0]->io);
+	shards_[0]->io.run();
+
+	for (auto& th : threads) {
+		th.join();
+	}
+}
+
+void network::Server::Stop() {
+	for (auto& shard : shards_) {
+		shard->io.stop();
+	}
+}
+
+void network::Server::SetConnectRate(double per_second) {
+	for (auto& shard : shards_) {
+		double rate = per_second / double(shards_.size());
+
+		// a second of the budget may pass at once after a quiet time
+		shard->admission.SetRate(rate, size_t(std::max(1.0, rate)));
+	}
+}
+
+/*
+*  Every shard accepts its own connections, so a connection storm is spread over all threads and
+*  the socket is created on the executor that serves it. With SO_REUSEPORT each shard has its own
+*  listening socket and the kernel balances the connections, otherwise the shards accept from one
+*/
+tcp::endpoint network::Server::Listen(const tcp::endpoint& endpoint) {
+	tcp::endpoint bound = endpoint;
+	std::shared_ptr<tcp::acceptor> shared;
+
+	for (auto& shard : shards_) {
+		std::shared_ptr<tcp::acceptor> acceptor = shared;
+
+		if (!acceptor) {
+			acceptor = std::make_shared<tcp::acceptor>(shard->io);
+			acceptor->open(bound.protocol());
+			acceptor->set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+			acceptor->set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+			acceptor->bind(bound);
+			acceptor->listen(asio::socket_base::max_listen_connections);
+
+			// the other shards listen on the port the first one got, when the endpoint has port 0
+			bound = acceptor->local_endpoint();
+#ifndef SO_REUSEPORT
+			shared = acceptor;
+#endif
+		}
+
+		asio::co_spawn(shard->io, Accept(std::move(acceptor), *shard), asio::detached);
+	}
+
+	return bound;
+}
+
+asio::awaitable<void> network::Server::Accept(std::shared_ptr<tcp::acceptor> acceptor, Shard& shard) {
+	asio::steady_timer pause(shard.io);
+
+	for (;;) {
+		system::error_code ec;
+		tcp::socket sock = co_await acceptor->async_accept(shard.io, asio::redirect_error(asio::use_awaitable, ec));
+
+		if (ec == asio::error::operation_aborted) {
+			co_return;
+		}
+
+		// out of descriptors or memory, the pending connections wait in the backlog meanwhile
+		if (ec) {
+			Log(warning, 0, "The connection can not be accepted: " + ec.message());
+			pause.expires_after(100ms);
+			co_await pause.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			continue;
+		}
+
+		unsigned int id_of_session = next_session_id_.fetch_add(1, std::memory_order_relaxed);
+
+		// the coroutine resumes on the thread of the shard even with a shared acceptor
+		shard.Accept(std::move(sock), id_of_session);
+	}
+}
+
+/*
+*  The publisher's shard delivers the message to its subscribers first.
+*  Other shards get the same encoded packets through their inboxes
+*/
+void network::Server::Publish(Shard& from, const mqtt::PublishView& src, std::chrono::steady_clock::time_point received,
+	uint64_t publisher) {
+
+	Publication pub;
+	pub.topic = std::string(src.topic);
+	pub.qos = uint8_t((src.header.bits & 0x6) >> 1u);
+	pub.received = received;
+
+	auto encode = [&](uint8_t qos) -> const shared_bytes& {
+		//create PUBLISH, established subscriptions always get RETAIN = 0 and DUP = 0, only a retransmission sets DUP
+		if (!pub.encoded[qos]) {
+			uint8_t bits = (src.header.bits & 0xF0) | (qos << 1u);
+			pub.encoded[qos] = mqtt::EncodePublish(bits, src.pkt_id, src.topic, src.payload);
+		}
+		return pub.encoded[qos];
+	};
+
+	if ((src.header.bits & 0x01) && mqtt::ValidTopicName(src.topic)) {
+		pub.retain = true;
+
+		if (!src.payload.empty()) {
+			auto retained = std::make_shared<Retained>();
+			retained->qos = pub.qos;
+
+			for (uint8_t qos = 0; qos <= pub.qos; qos++) {
+				uint8_t bits = (src.header.bits & 0xF1) | (qos << 1u);
+				retained->encoded[qos] = mqtt::EncodePublish(bits, src.pkt_id, src.topic, src.payload);
+			}
+			pub.retained = std::move(retained);
+		}
+		from.Retain(pub);
+	}
+
+	from.Route(pub.topic, pub.qos, encode, received);
+	from.RouteShared(pub.topic, pub.qos, encode, publisher);
+
+	if (shards_.size() == 1) {
+		return;
+	}
+
+	// other shards only read the publication, so every packet they may need is encoded here
+	for (uint8_t qos = 0; qos <= pub.qos; qos++) {
+		encode(qos);
+	}
+
+	auto shared = std::make_shared<const Publication>(std::move(pub));
+
+	for (auto& shard : shards_) {
+		if (shard.get() != &from) {
+			shard->Post(shared);
+		}
+	}
+}
+
+// This function returns a smart pointer to the session
+std::shared_ptr<network::Session> network::Server::GetSession(const std::string& client_id) {
+	Stripe& stripe = GetStripe(client_id);
+	std::lock_guard lock{ stripe.mutex };
+
+	auto user = stripe.clients.find(client_id);
+
+	if (user != end(stripe.clients)) {
+		return user->second;
+	}
+	return nullptr;
+}
+
+// The newest connection with the same client id wins
+void network::Server::RegisterSession(const std::string& client_id, std::shared_ptr<Session> session) {
+	Stripe& stripe = GetStripe(client_id);
+	std::lock_guard lock{ stripe.mutex };
+
+	stripe.clients[client_id] = std::move(session);
+}
+
+void network::Server::UnregisterSession(const std::string& client_id, Session* session) {
+	Stripe& stripe = GetStripe(client_id);
+	std::lock_guard lock{ stripe.mutex };
+
+	auto user = stripe.clients.find(client_id);
+
+	if (user != end(stripe.clients) && user->second.get() == session) {
+		stripe.clients.erase(user);
+	}
+}
+
+void network::Server::TransferSession(Shard& from, std::shared_ptr<Session> session, tcp::socket sock) {
+	Shard& to = session->GetShard();
+
+	if (&to == &from) {
+		session->TransferControl(std::move(sock));
+		session->CleanSessionHandler();
+		return;
+	}
+
+	// a socket is bound to the io_context of its shard, so only the descriptor is passed on
+	system::error_code ec;
+	tcp protocol = sock.local_endpoint(ec).protocol();
+	auto handle = sock.release();
+
+	asio::post(to.io, [session, handle, protocol, &to] {
+		session->TransferControl(tcp::socket(to.io, protocol, handle));
+		session->CleanSessionHandler();
+	});
+}
+
+void network::Server::DiscardSession(std::shared_ptr<Session> session) {
+	asio::post(session->GetShard().io, [session] {
+		session->Discard();
+	});
+}
+
+void network::Server::Share(Shard& from, const std::string& group, const std::string& filter, const SharedMember& member) {
+	for (auto& shard : shards_) {
+		if (shard.get() == &from) {
+			shard->Join(group, filter, member);
+			continue;
+		}
+
+		asio::post(shard->io, [&shard = *shard, group, filter, member] {
+			shard.Join(group, filter, member);
+		});
+	}
+}
+
+void network::Server::Unshare(Shard& from, const std::string& group, const std::string& filter, uint32_t handle) {
+	for (auto& shard : shards_) {
+		if (shard.get() == &from) {
+			shard->Leave(group, filter, from.GetIndex(), handle);
+			continue;
+		}
+
+		asio::post(shard->io, [&shard = *shard, group, filter, from = from.GetIndex(), handle] {
+			shard.Leave(group, filter, from, handle);
+		});
+	}
+}
+
+// The restored sessions are spread over the shards by their index in the store, the shards are filled in parallel
+void network::Server::Restore() {
+	if (store_ == nullptr) {
+		return;
+	}
+
+	std::vector<std::thread> threads;
+
+	for (auto& shard : shards_) {
+		threads.emplace_back([this, &shard] { shard->Restore(*store_, shards_.size()); });
+	}
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	Log(info, 0, std::to_string(store_->SessionSize()) + " sessions were restored from the store");
+}
+
+size_t network::Server::SessionSize() {
+	size_t size = 0;
+
+	for (auto& shard : shards_) {
+		size += shard->SessionSize();
+	}
+	return size;
+}
+
+network::MetricsSnapshot network::Server::CollectMetrics() {
+	MetricsSnapshot snapshot;
+
+	for (auto& shard : shards_) {
+		snapshot.Add(shard->metrics);
+	}
+	snapshot.sessions = SessionSize();
+	snapshot.uptime = std::chrono::steady_clock::now() - started_;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 heap = mallinfo2();
+	snapshot.heap = heap.uordblks + heap.hblkhd;
+#endif
+
+	return snapshot;
+}
+
+/*
+*  One timer serves the whole $SYS tree. The values are computed once per tick and every shard
+*  routes them to its own subscribers, a topic nobody subscribed to ends at the first level
+*  of the trie, before anything is encoded
+*/
+asio::awaitable<void> network::Server::PublishMetrics(std::chrono::seconds interval) {
+	asio::steady_timer timer{ co_await asio::this_coro::executor, interval };
+	SysTopics sys;
+
+	for (;;) {
+		co_await timer.async_wait(asio::use_awaitable);
+		timer.expires_at(timer.expiry() + interval);
+
+		auto topics = std::make_shared<const std::vector<std::pair<std::string, std::string>>>(sys.Update(CollectMetrics()));
+
+		for (auto& shard : shards_) {
+			asio::post(shard->io, [&shard = *shard, topics] { shard.PublishSys(*topics); });
+		}
+	}
+}
+
+asio::awaitable<void> network::Server::ServeMetrics(tcp::acceptor acceptor) {
+	for (;;) {
+		auto sock = co_await acceptor.async_accept(asio::use_awaitable);
+
+		std::string text = CollectMetrics().Format();
+
+		// the sessions belong to their shards, every shard describes its own
+		for (auto& shard : shards_) {
+			text += co_await asio::co_spawn(shard->io, [&shard]() -> asio::awaitable<std::string> {
+				co_return shard->DescribeSessions();
+			}, asio::use_awaitable);
+		}
+
+		boost::system::error_code ec;
+		co_await asio::async_write(sock, asio::buffer(text), asio::redirect_error(asio::use_awaitable, ec));
+		sock.shutdown(tcp::socket::shutdown_both, ec);
+	}
+}
+
+network::Server::Stripe& network::Server::GetStripe(const std::string& client_id) {
+	return registry_[std::hash<std::string>{}(client_id) % registry_.size()];
+}
+
+void network::Shard::Accept(tcp::socket sock, unsigned int id_of_session) {
+
+	// Checking if there is a free session
+	if (auto session = AcquireFreeSession()) {
+		session->TransferControl(std::move(sock));
+		return;
+	}
+
+	sessions_.push_back(std::make_shared<Session>(std::move(sock), id_of_session, *this));
+	session_count_.fetch_add(1, std::memory_order_relaxed);
+	sessions_.back()->Start();
+}
+
+/*
+*  The tree of the shard takes the shape of the stored trie in one copy of its arrays,
+*  only the subscribers of the clients of this shard are kept in the nodes
+*/
+void network::Shard::Restore(const Store& store, size_t shards) {
+	const std::vector<StoredClient>& clients = store.Clients();
+	const stored_tree& stored = store.Subscriptions();
+
+	// the sessions are created first, the subscriptions refer to their handles
+	std::vector<uint32_t> handles(clients.size(), kNoHandle);
+
+	for (uint32_t c = index_; c < clients.size(); c += uint32_t(shards)) {
+		if (!clients[c].active) {
+			continue;
+		}
+
+		sessions_.push_back(std::make_shared<Session>(tcp::socket(io), 0, *this));
+		session_count_.fetch_add(1, std::memory_order_relaxed);
+		sessions_.back()->Restore(clients[c]);
+		handles[c] = sessions_.back()->GetHandle();
+
+		if (handles[c] == kNoHandle) {
+			sessions_.pop_back();
+			session_count_.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	auto subscribers_of = [&](const std::vector<StoredSubscriber>& subscribers) {
+		tree::subscriber_set result;
+
+		for (const StoredSubscriber& s : subscribers) {
+			if (handles[s.client] != kNoHandle) {
+				result.insert(handles[s.client], s.qos);
+				metrics.Add(kSubscriptions);
+			}
+		}
+		return result;
+	};
+
+#ifdef MQTT_NODE_TRIE
+	for (uint32_t n = 0; n < stored.capacity(); n++) {
+		if (auto subscribers = subscribers_of(stored.at(n)); !subscribers.empty()) {
+			topics_.get(stored.path(n)) = std::move(subscribers);
+		}
+	}
+#else
+	topics_.assign(stored, [&](const std::vector<StoredSubscriber>& subscribers, uint32_t) {
+		return subscribers_of(subscribers);
+	});
+#endif
+
+	// the sessions learn where they are, shared subscriptions came into the tree like the others and go to their groups instead
+	for (uint32_t c = index_; c < clients.size(); c += uint32_t(shards)) {
+		if (handles[c] == kNoHandle) {
+			continue;
+		}
+
+		Session* session = clients_.Find(handles[c]);
+
+		for (uint32_t n : clients[c].nodes) {
+#ifdef MQTT_NODE_TRIE
+			subscription_node node = topics_.find(stored.path(n));
+#else
+			subscription_node node = n; // the tree has the ids of the store
+#endif
+			tree::subscriber_set& subscribers = Subscribers(node);
+			size_t slot = subscribers.index_of(handles[c]);
+
+			if (slot == tree::subscriber_set::npos) {
+				continue;
+			}
+
+			std::string topic = stored.path(n);
+			std::string_view group, filter;
+
+			if (!mqtt::SplitSharedFilter(topic, &group, &filter)) {
+				session->AddSubscription(SubscriptionRef{ node, uint32_t(slot) });
+				continue;
+			}
+
+			SharedMember member{ handles[c], subscribers.find(handles[c])->qos, index_, session, clients_.Hash(handles[c]) };
+
+			subscribers.erase(handles[c], slot);
+			server.Share(*this, std::string(group), std::string(filter), member);
+			session->AddSharedSubscription(std::move(topic));
+		}
+	}
+}
+
+template<class Encode>
+void network::Shard::Route(const std::string& topic, uint8_t qos, Encode&& encode, std::chrono::steady_clock::time_point received) {
+
+	// the clock is read once for all subscribers and not at all for a topic without them
+	std::chrono::steady_clock::time_point queued{};
+
+	topics_.match(topic, [&](const tree::subscriber_set& subscribers) {
+
+		for (const tree::subscriber& subscriber : subscribers) {
+
+			if (queued == std::chrono::steady_clock::time_point{}) {
+				queued = std::chrono::steady_clock::now();
+			}
+
+			//the message is delivered with the lower of the two QoS levels
+			uint8_t sub_qos = std::min(subscriber.qos, qos);
+
+			//send PUBLISH to subscriber
+			SendMessageTo(subscriber.handle, encode(sub_qos), queued);
+		}
+	});
+
+	if (queued != std::chrono::steady_clock::time_point{} && received != std::chrono::steady_clock::time_point{}) {
+		metrics.route.Record(std::chrono::steady_clock::now() - received);
+	}
+}
+
+/*
+*  Only the shard of the publisher looks at the shared groups, so every message reaches one member
+*  of a group. A member of another shard gets the packet through the queue of its io_context
+*/
+template<class Encode>
+void network::Shard::RouteShared(const std::string& topic, uint8_t qos, Encode&& encode, uint64_t publisher) {
+	if (shared_.empty()) {
+		return;
+	}
+
+	kShareStrategy strategy = server.GetShareStrategy();
+	std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now();
+
+	shared_.match(topic, [&](std::vector<SharedGroup>& groups) {
+
+		for (SharedGroup& group : groups) {
+			const SharedMember* member = group.Pick(strategy, publisher);
+
+			if (member == nullptr) {
+				continue;
+			}
+
+			shared_bytes packet = encode(std::min(member->qos, qos));
+
+			if (member->shard == index_) {
+				SendMessageTo(member->handle, std::move(packet), queued);
+				continue;
+			}
+
+			Shard& to = server.GetShard(member->shard);
+
+			asio::post(to.io, [&to, handle = member->handle, packet = std::move(packet), queued] {
+				to.SendMessageTo(handle, packet, queued);
+			});
+		}
+	});
+}
+
+void network::Shard::Join(const std::string& group, const std::string& filter, const SharedMember& member) {
+	std::vector<SharedGroup>& groups = shared_.get(filter);
+
+	auto it = std::find_if(groups.begin(), groups.end(), [&](const SharedGroup& g) { return g.name == group; });
+
+	if (it == groups.end()) {
+		it = groups.insert(groups.end(), SharedGroup{ group, {} });
+	}
+
+	// a client subscribing again only changes its QoS
+	for (SharedMember& m : it->members) {
+		if (m.shard == member.shard && m.handle == member.handle) {
+			m = member;
+			return;
+		}
+	}
+	it->members.push_back(member);
+}
+
+void network::Shard::Leave(const std::string& group, const std::string& filter, size_t shard, uint32_t handle) {
+	uint32_t n = shared_.find_node(filter);
+
+	if (n == shared_tree::none) {
+		return;
+	}
+
+	std::vector<SharedGroup>& groups = shared_.at(n);
+
+	for (auto it = groups.begin(); it != groups.end(); ++it) {
+		if (it->name != group) {
+			continue;
+		}
+
+		std::erase_if(it->members, [&](const SharedMember& m) { return m.shard == shard && m.handle == handle; });
+
+		if (it->members.empty()) {
+			groups.erase(it);
+		}
+		break;
+	}
+
+	shared_.prune(n, [](const std::vector<SharedGroup>& groups) { return groups.empty(); });
+}
+
+/*
+*  Round robin and the least queued member start from the member after the last one picked,
+*  so members with equal queues still take turns. The sticky member is the one with the highest
+*  hash of its client id mixed with the publisher, a member that leaves or joins moves
+*  only the publishers it loses or wins
+*/
+const network::SharedMember* network::SharedGroup::Pick(kShareStrategy strategy, uint64_t publisher) {
+	if (members.empty()) {
+		return nullptr;
+	}
+
+	size_t size = members.size();
+	size_t picked = next % size;
+
+	switch (strategy) {
+	case kShareLeastQueued: {
+		size_t least = SIZE_MAX;
+
+		for (size_t i = 0; i < size; i++) {
+			size_t k = (next + i) % size;
+			size_t depth = members[k].session->QueueDepth();
+
+			if (depth < least) {
+				least = depth;
+				picked = k;
+			}
+		}
+		break;
+	}
+	case kShareSticky: {
+		uint64_t best = 0;
+
+		for (size_t k = 0; k < size; k++) {
+			// the finalizer of splitmix64
+			uint64_t x = publisher ^ members[k].hash;
+			x = (x ^ (x >> 30u)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27u)) * 0x94d049bb133111ebull;
+			x ^= x >> 31u;
+
+			if (k == 0 || x > best) {
+				best = x;
+				picked = k;
+			}
+		}
+		return &members[picked];
+	}
+	default:
+		break;
+	}
+
+	next = picked + 1;
+	return &members[picked];
+}
+
+void network::Shard::Post(std::shared_ptr<const Publication> pub) {
+	inbox_.Push(std::move(pub));
+
+	// one drain is enough for any number of publications
+	if (!inbox_scheduled_.exchange(true)) {
+		asio::post(io, [this] { DrainInbox(); });
+	}
+}
+
+void network::Shard::DrainInbox() {
+
+	// publications pushed after this point schedule a new drain
+	inbox_scheduled_.store(false);
+
+	std::shared_ptr<const Publication> pub;
+
+	while (inbox_.Pop(pub)) {
+		if (pub->retain) {
+			Retain(*pub);
+		}
+
+		Route(pub->topic, pub->qos, [&](uint8_t qos) -> const shared_bytes& {
+			return pub->encoded[qos];
+		}, pub->received);
+	}
+}
+
+// $SYS messages are not retained, a shard without their subscribers does nothing
+void network::Shard::PublishSys(const std::vector<std::pair<std::string, std::string>>& topics) {
+	for (const auto& [topic, value] : topics) {
+		shared_bytes packet;
+
+		Route(topic, 0, [&](uint8_t) -> const shared_bytes& {
+			if (!packet) {
+				packet = mqtt::EncodePublish(PUBLISH_BYTE, 0, topic, value);
+			}
+			return packet;
+		});
+	}
+}
+
+void network::Shard::Retain(const Publication& pub) {
+	if (pub.retained) {
+		retained_.get(pub.topic) = pub.retained;
+		return;
+	}
+
+	uint32_t n = retained_.find_node(pub.topic);
+
+	if (n == retained_tree::none) {
+		return;
+	}
+
+	retained_.at(n).reset();
+
+	// a walk may stand on the node, it is removed when the last walk has finished
+	if (replaying_ > 0) {
+		cleared_.push_back(pub.topic);
+		return;
+	}
+	retained_.prune(n, [](const std::shared_ptr<const Retained>& retained) { return !retained; });
+}
+
+void network::Shard::EndReplay(size_t walks) {
+	replaying_ -= walks;
+
+	if (replaying_ > 0) {
+		return;
+	}
+
+	// the topics may have been retained again meanwhile, or pruned with another one
+	for (const std::string& topic : cleared_) {
+		uint32_t n = retained_.find_node(topic);
+
+		if (n != retained_tree::none && !retained_.at(n)) {
+			retained_.prune(n, [](const std::shared_ptr<const Retained>& retained) { return !retained; });
+		}
+	}
+	cleared_.clear();
+}
+
+void network::Shard::SendMessageTo(uint32_t handle, shared_bytes msg, std::chrono::steady_clock::time_point queued) {
+	if (Session* session = clients_.Find(handle)) {
+		session->RewriteBuffer(std::move(msg), queued);
+	}
+}
+
+tree::subscriber_set& network::Shard::Subscribers(subscription_node node) {
+#ifdef MQTT_NODE_TRIE
+	return *node;
+#else
+	return topics_.at(node);
+#endif
+}
+
+bool network::Shard::Subscribe(const std::string& filter, uint32_t handle, uint8_t qos, SubscriptionRef* ref) {
+#ifdef MQTT_NODE_TRIE
+	subscription_node node = &topics_.get(filter);
+#else
+	subscription_node node = topics_.node_of(filter);
+#endif
+	tree::subscriber_set& subscribers = Subscribers(node);
+
+	if (!subscribers.insert(handle, qos)) {
+		return false;
+	}
+
+	*ref = SubscriptionRef{ node, uint32_t(subscribers.size() - 1) };
+	metrics.Add(kSubscriptions);
+	return true;
+}
+
+/*
+*  Teardown costs one hint check per subscription, the filter is not walked down the tree again.
+*  Nodes left without subscribers go away, so topics used once by a client do not pile up
+*/
+void network::Shard::Unsubscribe(const SubscriptionRef& ref, uint32_t handle) {
+	if (!Subscribers(ref.node).erase(handle, ref.slot)) {
+		return;
+	}
+	metrics.Add(kSubscriptions, -1);
+
+#ifndef MQTT_NODE_TRIE
+	topics_.prune(ref.node, [](const tree::subscriber_set& subscribers) { return subscribers.empty(); });
+#endif
+}
+
+subscription_node network::Shard::FindNode(const std::string& filter) {
+#ifdef MQTT_NODE_TRIE
+	return topics_.find(filter);
+#else
+	return topics_.find_node(filter);
+#endif
+}
+
+void network::Shard::ReleaseSession(std::shared_ptr<Session> session) {
+	free_sessions_.push_back(std::move(session));
+}
+
+std::string network::Shard::DescribeSessions() const {
+	std::string text;
+
+	for (const auto& session : sessions_) {
+		if (session->GetId().empty()) {
+			continue;
+		}
+
+		const SessionMetrics& metrics = session->GetMetrics();
+		QueueStats stats = session->GetQueueStats();
+
+		text += "session " + session->GetId()
+			+ " shard=" + std::to_string(index_)
+			+ " connected=" + std::to_string(int(session->Connected()))
+			+ " messages_received=" + std::to_string(metrics.messages_in)
+			+ " messages_sent=" + std::to_string(metrics.messages_out)
+			+ " bytes_received=" + std::to_string(metrics.bytes_in)
+			+ " bytes_sent=" + std::to_string(metrics.bytes_out)
+			+ " queued=" + std::to_string(stats.queued_messages)
+			+ " queued_bytes=" + std::to_string(stats.queued_bytes)
+			+ " inflight=" + std::to_string(stats.inflight_messages)
+			+ " spilled=" + std::to_string(stats.spilled_messages)
+			+ " dropped=" + std::to_string(stats.dropped_messages) + '\n';
+	}
+	return text;
+}
+
+std::shared_ptr<network::Session> network::Shard::AcquireFreeSession() {
+	while (!free_sessions_.empty()) {
+		std::shared_ptr<Session> session = std::move(free_sessions_.back());
+		free_sessions_.pop_back();
+
+		// the session could have been taken by TransferControl after it was released
+		if (session->SessionIsFree()) {
+			return session;
+		}
+	}
+	return nullptr;
+}
+
+
+/*
+*  This is one of the most important functions.
+*  A packet with the received data is sent to her 
+*  and she processes it by calling special functions and handlers
+*/
+int network::Session::PacketHandler(uint8_t* packet, size_t size)
+{
+	int rc = -SHOULD_SEND;
+	mqtt::kDecodeStatus status = mqtt::kDecoded;
+
+	// the client has no handle before CONNECT, so nothing else may come first
+	if (handle_ == kNoHandle && (packet[0] >> 4) != CONNECT) {
+		Log(debug, id_of_session_, "The first packet is not CONNECT");
+		Stop();
+		return rc;
+	}
+
+	try {
+		switch (packet[0] >> 4) // Checking the package type
+			/*
+			*  In each case the packet object of the type we received is created,
+			*  a function of the Unpack type fills it from the frame
+			*  and the corresponding handler is called if the packet is valid
+			*/
+		{
+		case CONNECT:
+		{
+			mqtt::Connect con;
+
+			if ((status = mqtt::UnpackConnect(packet, size, &con)) == mqtt::kDecoded) {
+				rc = ConnectHandler(&con);
+			}
+			break;
+		}
+		case PUBLISH: {
+			// the topic and the payload stay in the frame, the payload is copied once into the packet for subscribers
+			mqtt::PublishView pub;
+
+			if ((status = mqtt::UnpackPublish(packet, size, &pub)) == mqtt::kDecoded) {
+				rc = PublishHandler(&pub);
+			}
+			break;
+		}
+
+		case SUBSCRIBE: {
+			mqtt::Subscribe sub;
+
+			if ((status = mqtt::UnpackSubscribe(packet, size, &sub)) == mqtt::kDecoded) {
+				rc = SubscribeHandler(&sub);
+			}
+			break;
+		}
+
+		case UNSUBSCRIBE: {
+			mqtt::Unsubscribe unsub;
+
+			if ((status = mqtt::UnpackUnsubscribe(packet, size, &unsub)) == mqtt::kDecoded) {
+				rc = UnsubscribeHandler(&unsub);
+			}
+			break;
+		}
+
+		case DISCONNECT:
+		case PINGREQ: {
+			mqtt::Header head;
+
+			if ((status = mqtt::UnpackHeader(packet, size, &head)) == mqtt::kDecoded) {
+				rc = (packet[0] >> 4) == PINGREQ ? PingreqHandler() : DisconnectHandler();
+			}
+			break;
+		}
+		default:
+			mqtt::AckPacket ack_packet;
+
+			if ((status = mqtt::UnpackAck(packet, size, &ack_packet)) != mqtt::kDecoded) {
+				break;
+			}
+
+			switch (packet[0] >> 4)
+			{
+			case PUBACK:
+				rc = PubackHandler(&ack_packet);
+				break;
+			case PUBREC:
+
+				rc = PubrecHandler(&ack_packet);
+				break;
+			case PUBREL:
+				rc = PubrelHandler(&ack_packet);
+				break;
+			case PUBCOMP:
+				rc = PubcompHandler(&ack_packet);
+				break;
+			}
+		}
+	}
+	catch (std::exception& ex) {
+		Log(error, id_of_session_,
+			"An error occurred while processing the package: " + std::string(ex.what()));
+	}
+
+	if (status != mqtt::kDecoded) {
+		Log(debug, id_of_session_, std::string("Malformed packet: ") + mqtt::DecodeStatusString(status));
+		Stop();
+	}
+
+	return rc;
+}
+
+network::Session::Session(tcp::socket sock, unsigned int id_of_session, Shard& shard)
+	: shard_(shard), sock_(std::move(sock)), timer_for_send(sock_.get_executor()), 
+	  timer_for_ping(sock_.get_executor()), timer_for_retry(sock_.get_executor()), id_of_session_(id_of_session), session_is_available(false) 
+{
+	timer_for_send.expires_at(std::chrono::steady_clock::time_point::max());
+}
+
+// Coroutines are initialized in this function
+void network::Session::Start() {
+	// coroutines of the previous connection see the new generation and finish
+	generation_++;
+	timer_for_send.cancel();
+
+	asio::co_spawn(sock_.get_executor(), ReadBytes(), asio::detached);
+	asio::co_spawn(sock_.get_executor(), SendBytes(), asio::detached);
+}
+
+/*
+* This function puts a packet in the queue of outgoing packets and wakes up SendBytes.
+* This is only used in the SendMessageTo function.
+* When the queue is full, QoS 0 messages are dropped and QoS 1 and 2 messages
+* either close the connection or go to the spill file, depending on the limits of the server
+*/
+void network::Session::RewriteBuffer(shared_bytes msg, std::chrono::steady_clock::time_point queued)
+{
+	const QueueLimits& limits = server.GetQueueLimits();
+	uint8_t qos = ((*msg)[0] >> 1) & 0x03;
+
+	// reliable messages stay behind the ones that are already on disk
+	if (qos > 0 && spill_ && !spill_->Empty()) {
+		if (Spill(msg)) {
+			Persist(msg);
+		}
+		return;
+	}
+
+	if (!Fits(msg->size())) {
+		if (qos == 0) {
+			if (limits.qos0 == kDropNewest || !DropOldest(msg->size())) {
+				Drop();
+				return;
+			}
+		}
+		else if (limits.reliable == kSpill) {
+			if (Spill(msg)) {
+				Persist(msg);
+			}
+			return;
+		}
+		else {
+			Drop();
+
+			// the message may be routed while the subscriptions are walked, so the session is stopped later
+			asio::post(sock_.get_executor(), [self = shared_from_this(), generation = generation_] {
+				if (self->generation_ == generation) {
+					self->Stop();
+				}
+			});
+			return;
+		}
+	}
+
+	Persist(msg);
+	EnqueueMessage(std::move(msg), queued);
+
+	timer_for_send.cancel_one();
+}
+
+network::QueueStats network::Session::GetQueueStats() const {
+	QueueStats stats;
+
+	stats.queued_messages = packets_.size();
+	stats.queued_bytes = queued_bytes_;
+	stats.spilled_messages = spill_ ? spill_->Size() : 0;
+	stats.dropped_messages = dropped_;
+	stats.inflight_messages = inflight_ ? inflight_->Size() : 0;
+
+	return stats;
+}
+
+void network::Session::Enqueue(shared_bytes packet) {
+	control_.push_back(OutFrame{ std::move(packet) });
+}
+
+// Acknowledgements are kept in the frame itself, so answering a QoS 1 or 2 packet does not allocate
+void network::Session::EnqueueAck(uint8_t first, uint16_t pkt_id) {
+	OutFrame frame;
+	frame.head = { first, 2, uint8_t(pkt_id >> 8u), uint8_t(pkt_id) };
+	frame.head_len = 4;
+
+	control_.push_back(frame);
+}
+
+void network::Session::EnqueueMessage(shared_bytes msg, std::chrono::steady_clock::time_point queued) {
+	queued_bytes_ += msg->size();
+	packets_.push_back(QueuedMessage{ std::move(msg), queued });
+	depth_.store(packets_.size(), std::memory_order_relaxed);
+	shard_.metrics.Add(kQueuedMessages);
+}
+
+// An empty queue takes a message of any size, so a big message is not dropped forever
+bool network::Session::Fits(size_t len) const {
+	const QueueLimits& limits = server.GetQueueLimits();
+
+	return packets_.empty()
+		|| (packets_.size() < limits.messages && queued_bytes_ + len <= limits.bytes);
+}
+
+// Removes the oldest QoS 0 messages until len bytes fit, control packets and QoS 1 and 2 stay
+bool network::Session::DropOldest(size_t len) {
+	auto it = packets_.begin();
+
+	while (!Fits(len) && it != packets_.end()) {
+		uint8_t first = (*it->packet)[0];
+
+		if ((first & 0xF0) == PUBLISH_BYTE && (first & 0x06) == 0) {
+			queued_bytes_ -= it->packet->size();
+			it = packets_.erase(it);
+			shard_.metrics.Add(kQueuedMessages, -1);
+			Drop();
+		}
+		else {
+			++it;
+		}
+	}
+
+	depth_.store(packets_.size(), std::memory_order_relaxed);
+	return Fits(len);
+}
+
+void network::Session::Drop() {
+	dropped_++;
+	shard_.metrics.Add(kMessagesDropped);
+
+	if (!dropping_) {
+		dropping_ = true;
+		Log(warning, id_of_session_, "The outgoing queue of " + cl.client_id_ + " is full, messages are dropped");
+	}
+}
+
+bool network::Session::Spill(const shared_bytes& msg) {
+	if (!spill_) {
+		spill_ = std::make_unique<SpillFile>();
+	}
+
+	if (!spill_->Push(*msg)) {
+		Log(error, id_of_session_, "The message could not be written to the spill file");
+		Drop();
+		return false;
+	}
+	return true;
+}
+
+// A QoS 1 or 2 message of a persistent session is kept in the store until it is delivered
+void network::Session::Persist(const shared_bytes& msg) {
+	Store* store = server.GetStore();
+
+	if (store == nullptr || !Persistent() || ((*msg)[0] & 0x06) == 0) {
+		return;
+	}
+
+	stored_.push_back(++stored_seq_);
+	store->AddMessage(cl.client_id_, stored_seq_, *msg);
+}
+
+// Moves messages from the spill file back to the queue while there is room
+void network::Session::Unspill() {
+	if (!spill_) {
+		return;
+	}
+
+	const QueueLimits& limits = server.GetQueueLimits();
+
+	while (!spill_->Empty() && packets_.size() < limits.messages && queued_bytes_ < limits.bytes) {
+		shared_bytes msg = spill_->Pop();
+
+		if (msg == nullptr) {
+			Log(error, id_of_session_, "The spill file could not be read");
+			dropped_ += spill_->Size();
+			shard_.metrics.Add(kMessagesDropped, int64_t(spill_->Size()));
+
+			// the lost messages are the last ones in the queue, they stay in the store until a restart
+			stored_.resize(stored_.size() - std::min(stored_.size(), spill_->Size()));
+			spill_.reset();
+			return;
+		}
+		EnqueueMessage(std::move(msg), std::chrono::steady_clock::now());
+	}
+}
+
+/*
+*  Retained messages of new subscriptions are queued a batch at a time, and only while
+*  the queue is short, so a subscription to "#" never holds all of them at once.
+*  The writer calls this again when the queue has room
+*/
+void network::Session::ReplayRetained() {
+	size_t batch = std::min(REPLAY_BATCH, server.GetQueueLimits().messages);
+
+	while (!replays_.empty() && packets_.size() < batch) {
+		Replay& replay = replays_.front();
+		size_t dropped = dropped_;
+
+		bool more = shard_.retained_.match_filter(replay.cursor, batch - packets_.size(), [&](const std::shared_ptr<const Retained>& retained) {
+			if (retained) {
+				RewriteBuffer(retained->encoded[std::min(retained->qos, replay.qos)]);
+			}
+		});
+
+		if (!more) {
+			replays_.pop_front();
+			shard_.EndReplay();
+		}
+
+		// the queue is full by bytes, the rest waits for the writer
+		if (dropped_ != dropped) {
+			break;
+		}
+	}
+}
+
+void network::Session::ClearQueue() {
+	shard_.metrics.Add(kQueuedMessages, -int64_t(packets_.size()));
+	shard_.metrics.Add(kInflightMessages, inflight_ ? -int64_t(inflight_->Size()) : 0);
+
+	shard_.EndReplay(replays_.size());
+	replays_.clear();
+	paused_.clear();
+	control_.clear();
+	packets_.clear();
+	depth_.store(0, std::memory_order_relaxed);
+	retransmit_.clear();
+	inflight_.reset();
+	timer_for_retry.cancel();
+	queued_bytes_ = 0;
+	dropped_ = 0;
+	dropping_ = false;
+	spill_.reset();
+	stored_.clear();
+	metrics_ = {};
+}
+
+const std::string& network::Session::GetId() const {
+	return cl.client_id_;
+}
+
+unsigned int network::Session::GetSessionId() {
+	return id_of_session_;
+}
+
+// This function gives control to some session
+void network::Session::TransferControl(tcp::socket sock) {
+	// the client has connected again before its previous connection was closed
+	if (sock_.is_open()) {
+		shard_.metrics.Add(kDisconnects);
+	}
+
+	sock_ = std::move(sock);
+	session_is_available = false;
+	this->Start();
+
+	// the retained messages of the subscriptions that were being replayed are replayed again
+	for (Replay& replay : paused_) {
+		replays_.push_back(std::move(replay));
+		shard_.BeginReplay();
+	}
+	paused_.clear();
+
+	// the client of a resumed session gets every unacknowledged message again
+	if (inflight_ && !inflight_->Empty()) {
+		Retransmit(std::chrono::steady_clock::time_point::max());
+		ScheduleRetry();
+	}
+
+	Log(info, id_of_session_, "We have transferred control to this session");
+}
+
+
+// This is a special handler that is called only if the Clear Session bit in the CONNECT packet is 0
+void network::Session::CleanSessionHandler() {
+
+	//before the session is fully restored, you need to send a CONNACK package
+	mqtt::Connack answer;
+
+	answer = std::move(mqtt::PacketConnack(CONNACK_BYTE, 1, 0));
+
+	uint8_ptr ptr = std::move(mqtt::PackConnack(&answer));
+
+	len_of_packet_ = 4;
+
+	std::vector<uint8_t> buf(len_of_packet_);
+
+	for (int i = 0; i < 4; i++) {
+		buf[i] = ptr.get()[i];
+	}
+
+	
+	//sock_.write_some(asio::buffer(buf, len_of_packet_));  //TODO
+
+	//Now we restore the contents of the variablesand the buffer
+
+	Enqueue(std::make_shared<const std::vector<uint8_t>>(std::move(buf)));
+	shard_.metrics.Add(kConnects);
+
+	timer_for_send.cancel_one();
+}
+
+bool network::Session::SessionIsFree() {
+	return session_is_available;
+}
+
+// The session is put in the free list and will be given to the next accepted connection
+void network::Session::MarkFree() {
+	if (!session_is_available && !Persistent()) {
+		session_is_available = true;
+		shard_.ReleaseSession(shared_from_this());
+	}
+}
+
+
+// The session waits without a connection until its client connects with clean session = 0
+void network::Session::Restore(const StoredClient& stored) {
+	handle_ = shard_.clients_.Intern(stored.id, this);
+
+	if (handle_ == kNoHandle) {
+		Log(error, id_of_session_, "The client table of the shard is full, the session of " + stored.id + " is not restored");
+		return;
+	}
+
+	cl.client_id_ = stored.id;
+	cl.connect_flags_ = 0;
+	cl.keepalive_ = 0;
+	persistent_ = true;
+	server.RegisterSession(stored.id, shared_from_this());
+
+	// the messages were accepted before the restart, so they are queued even over the limits
+	for (const auto& [seq, packet] : stored.messages) {
+		EnqueueMessage(std::make_shared<const std::vector<uint8_t>>(packet), std::chrono::steady_clock::now());
+		stored_.push_back(seq);
+		stored_seq_ = seq;
+	}
+}
+
+// The client connected with clean session = 1, so everything of its previous session is thrown away
+void network::Session::Discard() {
+	persistent_ = false;
+
+	if (sock_.is_open()) {
+		Stop();
+	}
+	else if (!cl.client_id_.empty()) {
+		EndSession();
+		MarkFree();
+	}
+}
+
+/* 
+*  This function sends WillMessage when the user disconnects from the server. 
+*  The will is published like a PUBLISH of the client itself,
+*  its topic and message are used in place without building a packet first
+*/
+void network::Session::SendWillMessage() {
+	if (cl.connect_flags_ & 0x4) {
+		mqtt::PublishView pub;
+
+		pub.header.bits = (((cl.connect_flags_ & 0x18) >> 2u) | ((cl.connect_flags_ & 0x20) >> 5u) | 0x30);
+		pub.topic = cl.will_topic_;
+		pub.payload = cl.will_msg_;
+
+		server.Publish(shard_, pub, {}, shard_.clients_.Hash(handle_));
+
+		Log(info, id_of_session_,
+			"Sent WillMessage for subscribers of " + cl.will_topic_);
+	}
+}
+
+/*
+*  This coroutine is responsible for reading the data.
+*  It reads as much as the socket has, passes every complete frame
+*  to PacketHandler and waits only when a frame is not fully received
+*/
+asio::awaitable<void> network::Session::ReadBytes() {
+	const unsigned int generation = generation_;
+
+	mqtt::FrameDecoder decoder;
+	size_t begin = 0; // the first byte of the current frame
+	size_t end = 0; // the end of the received data
+
+	try{
+		for (;;) {
+
+			size_t len = co_await sock_.async_read_some(
+				asio::buffer(buf_.data() + end, buf_.capacity() - end), asio::use_awaitable);
+
+			received_ = std::chrono::steady_clock::now();
+			metrics_.bytes_in += len;
+			shard_.metrics.Add(kBytesIn, int64_t(len));
+
+			bool buffer_is_full = end + len == buf_.capacity();
+			end += len;
+
+			int rc = -SHOULD_SEND;
+
+			// handle all frames that have already been received
+			for (;;) {
+				mqtt::FrameDecoder::kStatus status = decoder.Parse(buf_.data() + begin, end - begin);
+
+				if (status == mqtt::FrameDecoder::kNeedMore) {
+					break;
+				}
+
+				if (status == mqtt::FrameDecoder::kMalformed) {
+					Log(error, id_of_session_, "The remaining length is malformed");
+					Stop();
+					co_return;
+				}
+
+				uint8_t* frame = buf_.data() + begin;
+
+				int pack_type = frame[0] >> 4u;
+				if (pack_type < CONNECT || pack_type > DISCONNECT) {
+					std::stringstream ss;
+					ss << std::hex << int(frame[0]);
+					Log(error, id_of_session_, "There is no package with this type: 0x" + ss.str());
+					Stop();
+					co_return;
+				}
+
+				if (LogEnabled(info)) {
+					Log(info, id_of_session_,
+						"The package was successfully received. PACKET TYPE: " + std::to_string(int(pack_type)));
+				}
+
+				// during a connection storm the CONNECT waits for its turn in the budget of the shard
+				if (pack_type == CONNECT && shard_.admission.Limited()) {
+					auto now = std::chrono::steady_clock::now();
+					auto admitted = shard_.admission.Next(now);
+
+					if (admitted > now) {
+						asio::steady_timer turn(sock_.get_executor(), admitted);
+						system::error_code ec;
+
+						shard_.metrics.Add(kConnectsWaiting);
+						co_await turn.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+						shard_.metrics.Add(kConnectsWaiting, -1);
+
+						if (!sock_.is_open() || generation != generation_) {
+							co_return;
+						}
+					}
+				}
+
+				if (PacketHandler(frame, decoder.FrameSize()) == SHOULD_SEND) {
+					rc = SHOULD_SEND;
+				}
+
+				begin += decoder.FrameSize();
+				decoder.Reset();
+
+				// the handler has closed the connection or given it to another session
+				if (!sock_.is_open()) {
+					co_return;
+				}
+			}
+
+			if (rc == SHOULD_SEND) {
+				timer_for_send.cancel_one();
+			}
+
+			// move the incomplete frame to the beginning of the buffer
+			std::memmove(buf_.data(), buf_.data() + begin, end - begin);
+			end -= begin;
+			begin = 0;
+
+			// a full buffer means the client sends faster than we read, so the next read is bigger
+			size_t needed = decoder.Needed();
+			if (buffer_is_full) {
+				needed = std::max(needed, std::min(buf_.capacity() * 4, READ_CHUNK_LEN));
+			}
+
+			if (!buf_.Reserve(needed, end)) {
+				Log(error, id_of_session_, "The package is too big");
+				Stop();
+				co_return;
+			}
+
+			// after a large packet or a burst the session goes back to the smallest block
+			if (end == 0 && len <= BufferPool::kMinBlock) {
+				buf_.Shrink();
+			}
+		}
+	}
+	catch (std::exception&) {
+		// a dropped connection is no error of the server, after a network failure there are thousands of them
+		Log(info, id_of_session_, "The connection was lost");
+
+		// the client has gone without DISCONNECT, unless the connection was given to another session
+		if (generation == generation_) {
+			Stop();
+			MarkFree();
+		}
+	}
+	
+}
+
+/*
+* Sends everything that is queued with one gathering write, so a subscriber that gets many
+* small messages costs one writev per wakeup instead of a write per packet.
+* async_write itself continues after a partial write, the frames are kept alive until it finishes.
+*/
+asio::awaitable<void> network::Session::SendBytes() {
+	const unsigned int generation = generation_;
+
+	// the buffers point into the frames, so the frames must not move while they are written
+	std::vector<OutFrame> frames;
+	std::vector<asio::const_buffer> buffers;
+	frames.reserve(WRITE_BATCH_BUFFERS);
+
+	try {
+		while (generation == generation_ && sock_.is_open()) {
+
+			Unspill();
+			ReplayRetained();
+			size_t bytes = TakeBatch(frames);
+
+			if (frames.empty()) {
+				if (packets_.empty()) {
+					dropping_ = false;
+				}
+
+				boost::system::error_code ec;
+				co_await timer_for_send.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				continue;
+			}
+
+			for (const OutFrame& frame : frames) {
+				if (!frame.packet) {
+					buffers.push_back(asio::buffer(frame.head.data(), frame.head_len));
+				}
+				else if (frame.id == 0) {
+					buffers.push_back(asio::buffer(*frame.packet));
+				}
+				else {
+					const uint8_t* data = frame.packet->data();
+					size_t offset = mqtt::PublishIdOffset(data);
+
+					buffers.push_back(asio::buffer(frame.head.data(), 1));
+					buffers.push_back(asio::buffer(data + 1, offset - 1));
+					buffers.push_back(asio::buffer(frame.head.data() + 1, sizeof(uint16_t)));
+					buffers.push_back(asio::buffer(data + offset + sizeof(uint16_t), frame.packet->size() - offset - sizeof(uint16_t)));
+				}
+			}
+
+			boost::system::error_code ec;
+			co_await asio::async_write(sock_, buffers, asio::redirect_error(asio::use_awaitable, ec));
+
+			if (!ec) {
+				Written(frames, bytes);
+			}
+
+			frames.clear();
+			buffers.clear();
+
+			if (ec) {
+				// the socket is closed by Stop or taken by another connection of the session
+				if (ec != asio::error::operation_aborted) {
+					Log(error, id_of_session_, "The package was not sent: " + ec.message());
+				}
+				co_return;
+			}
+		}
+	}
+	catch (std::exception&) {
+		Log(error, id_of_session_, "error during sending");
+	}
+}
+
+/*
+* Control packets go first, then retransmissions, then new messages.
+* A QoS 1 or 2 message gets its packet id here and waits in the queue while the
+* in-flight window is full, the messages behind it wait too, so the order is kept.
+* The batch is limited by bytes and by buffers, the first packet is always taken
+*/
+size_t network::Session::TakeBatch(std::vector<OutFrame>& frames) {
+	size_t bytes = 0;
+	size_t buffers = 0;
+	auto now = std::chrono::steady_clock::now();
+
+	auto fits = [&](const OutFrame& frame) {
+		return frames.empty()
+			|| (buffers + frame.Buffers() <= WRITE_BATCH_BUFFERS && bytes + frame.Size() <= WRITE_BATCH_LEN);
+	};
+
+	auto take = [&](OutFrame&& frame) {
+		bytes += frame.Size();
+		buffers += frame.Buffers();
+		frames.push_back(std::move(frame));
+	};
+
+	while (!control_.empty() && fits(control_.front())) {
+		take(std::move(control_.front()));
+		control_.pop_front();
+	}
+
+	while (!retransmit_.empty()) {
+		InflightWindow::Slot* slot = inflight_ ? inflight_->Find(retransmit_.front()) : nullptr;
+
+		// acknowledged while it waited
+		if (slot == nullptr || !slot->queued) {
+			retransmit_.pop_front();
+			continue;
+		}
+
+		OutFrame frame;
+
+		if (slot->state == InflightWindow::kWaitAck) {
+			frame.packet = slot->packet;
+			frame.id = slot->id;
+			frame.head = { uint8_t(slot->packet->front() | 0x08), uint8_t(slot->id >> 8u), uint8_t(slot->id) }; // DUP
+		}
+		else {
+			frame.head = { PUBREL_BYTE, 2, uint8_t(slot->id >> 8u), uint8_t(slot->id) };
+			frame.head_len = 4;
+		}
+
+		if (!fits(frame)) {
+			break;
+		}
+
+		slot->sent = now;
+		slot->queued = false;
+		retransmit_.pop_front();
+		take(std::move(frame));
+	}
+
+	while (!packets_.empty()) {
+		OutFrame frame{ packets_.front().packet };
+		frame.queued = packets_.front().queued;
+		uint8_t qos = (frame.packet->front() >> 1u) & 0x03;
+
+		if (qos > 0) {
+			if (!inflight_) {
+				inflight_ = std::make_unique<InflightWindow>(server.GetQueueLimits().inflight);
+			}
+
+			if (inflight_->Full()) {
+				break;
+			}
+
+			// counted by fits() as a PUBLISH with an id, the real id is taken below
+			frame.id = 1;
+		}
+
+		if (!fits(frame)) {
+			break;
+		}
+
+		if (qos > 0) {
+			bool was_empty = inflight_->Empty();
+			uint64_t seq = 0;
+
+			if (!stored_.empty()) {
+				seq = stored_.front();
+				stored_.pop_front();
+			}
+
+			frame.id = inflight_->Add(frame.packet, now, seq);
+			shard_.metrics.Add(kInflightMessages);
+			frame.head = { frame.packet->front(), uint8_t(frame.id >> 8u), uint8_t(frame.id) };
+
+			if (was_empty) {
+				ScheduleRetry();
+			}
+		}
+
+		queued_bytes_ -= frame.Size();
+		packets_.pop_front();
+		shard_.metrics.Add(kQueuedMessages, -1);
+		take(std::move(frame));
+	}
+
+	depth_.store(packets_.size(), std::memory_order_relaxed);
+	return bytes;
+}
+
+// The messages of the batch are counted when the write has finished, the clock is read once for all of them
+void network::Session::Written(const std::vector<OutFrame>& frames, size_t bytes) {
+	size_t messages = 0;
+	std::chrono::steady_clock::time_point now{};
+
+	for (const OutFrame& frame : frames) {
+		if (frame.queued == std::chrono::steady_clock::time_point{}) {
+			continue;
+		}
+
+		if (messages++ == 0) {
+			now = std::chrono::steady_clock::now();
+		}
+		shard_.metrics.write.Record(now - frame.queued);
+	}
+
+	metrics_.messages_out += messages;
+	metrics_.bytes_out += bytes;
+	shard_.metrics.Add(kMessagesOut, int64_t(messages));
+	shard_.metrics.Add(kBytesOut, int64_t(bytes));
+}
+
+// Messages that are not acknowledged in RETRY_INTERVAL are sent again with DUP
+void network::Session::ScheduleRetry() {
+	timer_for_retry.expires_after(RETRY_INTERVAL);
+	timer_for_retry.async_wait([self = shared_from_this(), generation = generation_](const boost::system::error_code& ec) {
+		if (ec == asio::error::operation_aborted || self->generation_ != generation || !self->inflight_) {
+			return;
+		}
+
+		self->Retransmit(std::chrono::steady_clock::now() - RETRY_INTERVAL);
+
+		if (!self->inflight_->Empty()) {
+			self->ScheduleRetry();
+		}
+	});
+}
+
+void network::Session::Retransmit(std::chrono::steady_clock::time_point deadline) {
+	inflight_->Expired(deadline, retransmit_);
+
+	if (!retransmit_.empty()) {
+		timer_for_send.cancel_one();
+	}
+}
+
+// The message is delivered, a free place in the window may let the queued messages go
+int network::Session::Acknowledge(uint16_t pkt_id, InflightWindow::kState state) {
+	if (!inflight_) {
+		return -SHOULD_SEND;
+	}
+
+	InflightWindow::Slot* slot = inflight_->Find(pkt_id);
+	uint64_t seq = slot != nullptr ? slot->seq : 0;
+
+	if (!inflight_->Complete(pkt_id, state)) {
+		return -SHOULD_SEND;
+	}
+	shard_.metrics.Add(kInflightMessages, -1);
+
+	if (seq != 0 && server.GetStore() != nullptr) {
+		server.GetStore()->RemoveMessage(cl.client_id_, seq);
+	}
+
+	return packets_.empty() ? -SHOULD_SEND : SHOULD_SEND;
+}
+
+void network::Session::Stop(bool delete_session) {
+	if (sock_.is_open()) {
+
+		boost::system::error_code ec;
+		sock_.shutdown(tcp::socket::shutdown_both, ec);
+		sock_.close(ec);
+		Log(info, id_of_session_, "The session was over");
+		timer_for_send.cancel();
+
+		if (!cl.client_id_.empty()) {
+			shard_.metrics.Add(kDisconnects);
+		}
+
+		SendWillMessage();
+
+		// the subscriptions and the messages wait for the client to connect again
+		if (Persistent()) {
+			// the walks must not hold the cleared retained topics of the shard while the client is away
+			for (Replay& replay : replays_) {
+				replay.cursor.rewind();
+				paused_.push_back(std::move(replay));
+			}
+			shard_.EndReplay(replays_.size());
+			replays_.clear();
+
+			control_.clear();
+			timer_for_retry.cancel();
+			return;
+		}
+
+		EndSession();
+	}
+}
+
+void network::Session::EndSession() {
+	// delete all user subscriptions through the reverse index, the handle becomes stale
+	if (handle_ != kNoHandle) {
+		for (const SubscriptionRef& ref : subscriptions_) {
+			shard_.Unsubscribe(ref, handle_);
+		}
+
+		for (const std::string& topic : shared_filters_) {
+			std::string_view group, filter;
+			mqtt::SplitSharedFilter(topic, &group, &filter);
+
+			server.Unshare(shard_, std::string(group), std::string(filter), handle_);
+			shard_.metrics.Add(kSubscriptions, -1);
+		}
+
+		shard_.clients_.Release(handle_); //delete user from database
+		handle_ = kNoHandle;
+	}
+
+	subscriptions_.clear();
+	shared_filters_.clear();
+
+	server.UnregisterSession(cl.client_id_, this);
+
+	cl.client_id_.clear();
+	cl.connect_flags_ = 0x0;
+	cl.password_.clear();
+	cl.username_.clear();
+	cl.will_msg_.clear();
+	cl.will_topic_.clear();
+
+	ClearQueue();
+}
+
+network::Session::~Session() {
+} 
+
+int network::Session::ConnectHandler(mqtt::Connect* pkt) {
+
+	if(pkt->payload.cliend_id.empty()) {
+		Log(debug, id_of_session_, "Client Id is empty");
+		Stop();
+		return -SHOULD_SEND;
+	}
+
+	
+	if ((pkt->variable_header.connect_flags & 0x2) == 0) {
+		auto session = server.GetSession(pkt->payload.cliend_id);
+
+		//We must restore the connection
+		if (session != nullptr) {
+			server.TransferSession(shard_, session, std::move(sock_));
+			MarkFree();
+			Stop();
+			return -SHOULD_SEND;
+		}
+	}
+	else if (auto session = server.GetSession(pkt->payload.cliend_id)) {
+		// a clean session starts from nothing, the previous session of the client is thrown away
+		if (session->Persistent() && server.GetStore() != nullptr) {
+			server.GetStore()->RemoveSession(pkt->payload.cliend_id);
+		}
+		server.DiscardSession(session);
+	}
+
+	handle_ = shard_.clients_.Intern(pkt->payload.cliend_id, this);
+
+	if (handle_ == kNoHandle) {
+		Log(error, id_of_session_, "The client table of the shard is full, the client is refused");
+		Stop();
+		return -SHOULD_SEND;
+	}
+
+	std::vector<uint8_t> buf;
+
+	cl.client_id_ = pkt->payload.cliend_id;
+	cl.connect_flags_ = pkt->variable_header.connect_flags;
+	cl.password_ = pkt->payload.password;
+	cl.username_ = pkt->payload.username;
+	cl.will_msg_ = pkt->payload.will_message;
+	cl.will_topic_ = pkt->payload.will_topic;
+	cl.keepalive_ = pkt->variable_header.keepalive;
+	persistent_ = (cl.connect_flags_ & 0x2) == 0;
+
+	if (Persistent() && server.GetStore() != nullptr) {
+		server.GetStore()->AddSession(cl.client_id_);
+	}
+
+	server.RegisterSession(cl.client_id_, shared_from_this());
+
+	timer_for_ping.expires_after(std::chrono::seconds(cl.keepalive_ * 2));
+	timer_for_ping.async_wait([&](const boost::system::error_code &ec) { 
+		if (!(ec == asio::error::operation_aborted)) {
+			this->Stop();
+		}
+		});
+	timer_for_ping.cancel();
+
+	//make CONNACK packet
+	mqtt::Connack answer;
+	
+	answer = std::move(mqtt::PacketConnack(CONNACK_BYTE, 0, 0));
+
+	uint8_ptr ptr = std::move(mqtt::PackConnack(&answer));
+
+	for(int i = 0; i < 4; i++) {
+		buf.push_back(ptr.get()[i]);
+	}
+	buf.resize(4);
+	len_of_packet_ = 4;
+	Enqueue(std::make_shared<const std::vector<uint8_t>>(std::move(buf)));
+	shard_.metrics.Add(kConnects);
+	
+	return SHOULD_SEND;
+}
+
+int network::Session::DisconnectHandler() {
+	Stop();
+	MarkFree();
+	return -SHOULD_SEND; 
+}
+
+int network::Session::SubscribeHandler(mqtt::Subscribe* ptr) {
+
+	std::vector<uint8_t> rcs;
+
+	for (auto& [topic, qos] : ptr->topic_and_qos) {
+		if (LogEnabled(info)) {
+			Log(info, id_of_session_,
+				"The user (" + cl.client_id_ + ") subscribed " + "[ Topic: " + topic + " Qos: " + std::to_string(qos) + "]");
+		}
+
+		std::string_view group, filter;
+		bool shared = mqtt::SplitSharedFilter(topic, &group, &filter);
+
+		// wildcards are kept in the tree as they are and evaluated when a message is published
+		if (shared ? !mqtt::ValidSharedFilter(group, filter) : !mqtt::ValidTopicFilter(topic)) {
+			rcs.push_back(0x80);
+			continue;
+		}
+
+		rcs.push_back(qos);
+
+		if (Persistent() && server.GetStore() != nullptr) {
+			server.GetStore()->Subscribe(cl.client_id_, topic, qos);
+		}
+
+		// a shared subscription gets no retained messages
+		if (shared) {
+			if (std::find(shared_filters_.begin(), shared_filters_.end(), topic) == shared_filters_.end()) {
+				shared_filters_.push_back(topic);
+				shard_.metrics.Add(kSubscriptions);
+			}
+
+			server.Share(shard_, std::string(group), std::string(filter),
+				SharedMember{ handle_, qos, shard_.GetIndex(), this, shard_.clients_.Hash(handle_) });
+			continue;
+		}
+
+		// subscribing again only changes the QoS, the retained messages are sent again
+		if (SubscriptionRef ref; shard_.Subscribe(topic, handle_, qos, &ref)) {
+			subscriptions_.push_back(ref);
+		}
+
+		// sent after the SUBACK, control packets go first
+		replays_.push_back(Replay{ retained_tree::filter_cursor{ topic }, qos });
+		shard_.BeginReplay();
+	}
+
+	//create SUBACK
+	mqtt::Suback sub = std::move(mqtt::PacketSuback(SUBACK_BYTE, ptr->pkt_id, rcs.size(), rcs.data()));
+
+	uint8_ptr pkt = std::move(mqtt::PackSuback(&sub));
+
+
+	len_of_packet_ = 4;
+	len_of_packet_ += ptr->topic_and_qos.size();
+
+	std::vector<uint8_t> buf(len_of_packet_);
+
+	for (int i = 0; i < len_of_packet_; i++) {
+		buf[i] = pkt.get()[i];
+	}
+	Enqueue(std::make_shared<const std::vector<uint8_t>>(std::move(buf)));
+
+	return SHOULD_SEND;
+}
+
+int network::Session::UnsubscribeHandler(mqtt::Unsubscribe* ptr) {
+
+	//unsubscribe from the specified topics
+	for (auto topic : ptr->topics) {
+
+		if (Persistent() && server.GetStore() != nullptr) {
+			server.GetStore()->Unsubscribe(cl.client_id_, topic);
+		}
+
+		std::string_view group, filter;
+
+		if (mqtt::SplitSharedFilter(topic, &group, &filter)) {
+			auto joined = std::find(shared_filters_.begin(), shared_filters_.end(), topic);
+
+			if (joined != shared_filters_.end()) {
+				shared_filters_.erase(joined);
+				server.Unshare(shard_, std::string(group), std::string(filter), handle_);
+				shard_.metrics.Add(kSubscriptions, -1);
+			}
+			continue;
+		}
+
+		subscription_node node = shard_.FindNode(topic);
+		auto ref = std::find_if(subscriptions_.begin(), subscriptions_.end(), [node](const SubscriptionRef& r) { return r.node == node; });
+
+		if (node == kNoNode || ref == subscriptions_.end())
+			continue;
+
+		shard_.Unsubscribe(*ref, handle_);
+
+		*ref = subscriptions_.back();
+		subscriptions_.pop_back();
+	}
+
+	//create UNSUBACK
+	EnqueueAck(UNSUBACK_BYTE, ptr->pkt_id);
+
+	return SHOULD_SEND;
+}
+
+/*
+*  Every subscriber gets the same bytes of the PUBLISH.
+*  The packet is encoded at most once for each QoS level
+*/
+int network::Session::PublishHandler(mqtt::PublishView* ptr) {
+
+	metrics_.messages_in++;
+	shard_.metrics.Add(kMessagesIn);
+
+	server.Publish(shard_, *ptr, received_, shard_.clients_.Hash(handle_));
+
+	switch ((ptr->header.bits & 0x6) >> 1u) {
+	case 1:
+		EnqueueAck(PUBACK_BYTE, ptr->pkt_id);
+		return SHOULD_SEND;
+	case 2:
+		EnqueueAck(PUBREC_BYTE, ptr->pkt_id);
+		return SHOULD_SEND;
+	}
+	
+	return -SHOULD_SEND;
+}
+
+int network::Session::PubackHandler(mqtt::Puback* ptr) {
+	return Acknowledge(ptr->pkt_id, InflightWindow::kWaitAck);
+}
+
+int network::Session::PubrecHandler(mqtt::Pubrec* ptr) {
+
+	if (inflight_) {
+		inflight_->Received(ptr->pkt_id);
+	}
+
+	//create PUBREL
+	EnqueueAck(PUBREL_BYTE, ptr->pkt_id);
+	
+	return SHOULD_SEND;
+}
+
+int network::Session::PubrelHandler(mqtt::Pubrel* ptr) {
+	
+	//create PUBCOMP
+	EnqueueAck(PUBCOMP_BYTE, ptr->pkt_id);
+
+	return SHOULD_SEND;
+}
+
+int network::Session::PubcompHandler(mqtt::Pubcomp* ptr) {
+	return Acknowledge(ptr->pkt_id, InflightWindow::kWaitComp);
+}
+
+int network::Session::PingreqHandler() {
+
+	timer_for_ping.cancel();
+	timer_for_ping.expires_after(std::chrono::seconds(cl.keepalive_ * 2));
+
+	timer_for_ping.async_wait([&](const boost::system::error_code& ec) {
+		if (!(ec == asio::error::operation_aborted)) {
+		this->Stop();
+	}});
+
+	std::vector<uint8_t> buf(2);
+	buf[0] = PINGRESP_BYTE;
+	buf[1] = 0;
+	len_of_packet_ = 2;
+	Enqueue(std::make_shared<const std::vector<uint8_t>>(std::move(buf)));
+	return SHOULD_SEND;
+}
@@ -1,114 +1,484 @@
-#ifndef MQTT_NETWORK_SERVER_H_
-#define MQTT_NETWORK_SERVER_H_
-
-#include <memory>
-#include <string>
-#include <array>
-#include <queue>
-#include <algorithm>
-#include <chrono>
-
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/ip/tcp.hpp>
-#include <boost/asio/buffer.hpp>
-#include <boost/asio/awaitable.hpp>
-#include <boost/asio/use_awaitable.hpp>
-#include <boost/asio/co_spawn.hpp>
-#include <boost/asio/detached.hpp>
-#include <boost/asio/this_coro.hpp>
-#include <boost/asio/steady_timer.hpp>
-#include <boost/asio/redirect_error.hpp>
-
-#include "../utility/mqtt.hpp"
-#include "../utility/core.hpp"
-#include "log/log.hpp"
-#include "../utility/trie.hpp"
-
-#define SHOULD_SEND 1
-#define MAX_PACKET_LEN 268435456
-
-using namespace boost;
-using asio::ip::tcp;
-
-typedef tree::trie<std::list<std::shared_ptr<Subscriber>>> subscriptions_tree;
-using namespace std::chrono_literals;
-
-namespace network {
-
-	class Session;
-
-	struct {
-		subscriptions_tree topics_;
-		std::map<std::string, std::list<std::string>> clients_;
-
-	} curiosity;
-
-
-	static class Server {
-	public:
-
-		asio::awaitable<void> Listen(tcp::acceptor acceptor, std::string filename);
-		
-		void SendMessageTo(std::string id, uint8_t *msg, size_t len_of_msg);
-
-		std::shared_ptr<Session> GetSession(std::string& client_id);
-
-		size_t SessionSize() { return sessions_.size(); }
-
-		std::string GetFilename() { return filename_; }
-
-	private:
-		std::list<std::shared_ptr<Session>> sessions_;
-		std::string filename_;
-		
-	} server;
-
-	class Session {
-	public:
-		Session(tcp::socket sock, unsigned int id_of_session);
-		void Start();
-		void RewriteBuffer(uint8_t *buf, size_t len_of_msg);
-		std::string GetId();
-		unsigned int GetSessionId();
-		void TransferControl(tcp::socket sock);
-		void CleanSessionHandler();
-		bool SessionIsFree();
-		void SendWillMessage();
-
-		asio::awaitable<void> ReadBytes();
-		asio::awaitable<void> SendBytes();
-		
-		int PacketHandler(uint8_t* packet);
-
-		int ConnectHandler(mqtt::Connect*);
-		int DisconnectHandler();
-		int SubscribeHandler(mqtt::Subscribe*);
-		int UnsubscribeHandler(mqtt::Unsubscribe*);
-		int PublishHandler(mqtt::Publish*);
-		int PubrecHandler(mqtt::Pubrec*);
-		int PubrelHandler(mqtt::Pubrel*);
-		int PingreqHandler();
-
-		void Stop(bool delete_session = false);
-
-		~Session();
-	private:
-		tcp::socket sock_;
-		asio::steady_timer timer_for_send;
-		asio::steady_timer timer_for_ping;
-
-		std::array<uint8_t, 268'435'456> buf_;
-		std::queue<std::vector<uint8_t>> packets_;
-		Client cl;
-
-		bool should_send_ = false;
-		bool session_is_available;
-		size_t len_of_packet_ = 0;
-
-		unsigned int id_of_session_;
-	};
-	
-} //namespace network
-
-#endif 
-
+#ifndef MQTT_NETWORK_SERVER_H_
+#define MQTT_NETWORK_SERVER_H_
+
+#include <memory>
+#include <string>
+#include <array>
+#include <queue>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/write.hpp>
+
+#include "../utility/mqtt.hpp"
+#include "../utility/core.hpp"
+#include "log/log.hpp"
+#include "buffer_pool.hpp"
+#include "mpsc_queue.hpp"
+#include "spill_file.hpp"
+#include "inflight.hpp"
+#include "metrics.hpp"
+#include "client_table.hpp"
+#include "admission.hpp"
+#include "store.hpp"
+#include "../utility/trie.hpp"
+#include "../utility/flat_trie.hpp"
+#include "../utility/subscriber_set.hpp"
+#include "../utility/frame_decoder.hpp"
+
+#define SHOULD_SEND 1
+#define MAX_PACKET_LEN 268435456
+#define READ_CHUNK_LEN size_t(65536)
+#define WRITE_BATCH_LEN size_t(262144)
+#define WRITE_BATCH_BUFFERS size_t(64) // asio gathers at most 64 buffers in one writev
+#define RETRY_INTERVAL std::chrono::seconds(20)
+#define REPLAY_BATCH size_t(256) // retained messages queued at once for a new subscription
+
+using namespace boost;
+using asio::ip::tcp;
+
+// MQTT_NODE_TRIE switches back to the node based tree, the flat one is faster on big trees
+#ifdef MQTT_NODE_TRIE
+typedef tree::trie<tree::subscriber_set> subscriptions_tree;
+typedef tree::subscriber_set* subscription_node; // the data of a node never moves
+constexpr subscription_node kNoNode = nullptr;
+#else
+typedef tree::flat_trie<tree::subscriber_set> subscriptions_tree;
+typedef uint32_t subscription_node;               // node id
+constexpr subscription_node kNoNode = subscriptions_tree::none;
+#endif
+using namespace std::chrono_literals;
+
+namespace network {
+
+	class Session;
+
+	// What happens to a message that does not fit into the outgoing queue of a session
+	enum kQos0Policy {
+		kDropOldest,
+		kDropNewest
+	};
+
+	enum kReliablePolicy {
+		kDisconnect, // QoS 1 and 2 messages close the connection of a slow subscriber
+		kSpill       // QoS 1 and 2 messages are kept on disk until the queue has room
+	};
+
+	// Limits of the outgoing queue of every session, control packets are never dropped
+	struct QueueLimits {
+		size_t messages = 10000;
+		size_t bytes = 16 * 1024 * 1024;
+		kQos0Policy qos0 = kDropOldest;
+		kReliablePolicy reliable = kDisconnect;
+		size_t inflight = 32; // QoS 1 and 2 messages sent and not acknowledged, like Receive Maximum
+	};
+
+	struct QueueStats {
+		size_t queued_messages = 0;
+		size_t queued_bytes = 0;
+		size_t spilled_messages = 0; // on disk right now
+		size_t dropped_messages = 0; // since the connection was accepted
+		size_t inflight_messages = 0;
+	};
+
+	// Last PUBLISH with RETAIN = 1 of a topic, sent to every new subscription that matches it
+	struct Retained {
+		uint8_t qos;
+
+		// encoded with RETAIN = 1 for each QoS level of delivery
+		std::array<shared_bytes, 3> encoded;
+	};
+
+	// PUBLISH that is routed by every shard to its own subscribers
+	struct Publication {
+		std::string topic;
+		uint8_t qos;
+
+		// the same packet for each QoS level of delivery
+		std::array<shared_bytes, 3> encoded;
+
+		// RETAIN = 1, an empty message removes the retained message of the topic and has no retained
+		bool retain = false;
+		std::shared_ptr<const Retained> retained;
+
+		// when the PUBLISH was read, zero for the messages of the broker itself
+		std::chrono::steady_clock::time_point received{};
+	};
+
+	// Retained messages are kept in the flat trie with any tree of subscriptions, it is walked by topic filters
+	typedef tree::flat_trie<std::shared_ptr<const Retained>> retained_tree;
+
+	// How a shared subscription group picks the one member that gets a message
+	enum kShareStrategy {
+		kShareRoundRobin,
+		kShareLeastQueued, // the member with the shortest outgoing queue
+		kShareSticky       // the same member for every message of a publisher while the group does not change
+	};
+
+	struct SharedMember {
+		uint32_t handle;                        // of the session in its shard
+		uint8_t qos;
+		size_t shard;                           // the shard of the session
+		const Session* session;                 // its queue depth is read by kShareLeastQueued from other shards
+		uint64_t hash = 0;                      // of the client id, for kShareSticky
+	};
+
+	// Subscribers of "$share/{name}/{filter}", every shard keeps a copy and picks members on its own
+	struct SharedGroup {
+		std::string name;
+		std::vector<SharedMember> members;
+		size_t next = 0; // where the next round starts
+
+		const SharedMember* Pick(kShareStrategy strategy, uint64_t publisher);
+	};
+
+	typedef tree::flat_trie<std::vector<SharedGroup>> shared_tree;
+
+	/*
+	*  A subscription as its session finds it again: the node of the filter and the position of the session
+	*  in the subscribers there. Erasing moves the last subscriber of a node, so the position is only a hint
+	*/
+	struct SubscriptionRef {
+		subscription_node node;
+		uint32_t slot;
+	};
+
+	/*
+	*  All state of one worker thread.
+	*  Sessions, subscriptions and the index of clients belong to the shard
+	*  that accepted the connection and are used only by the thread of this shard.
+	*  Other shards reach it only through the inbox.
+	*/
+	class Shard {
+	public:
+		explicit Shard(size_t index) : index_(index) {}
+
+		void Accept(tcp::socket sock, unsigned int id_of_session);
+
+		// Takes the subscriptions and sessions of the store whose client index % shards is the index of this shard
+		void Restore(const Store& store, size_t shards);
+
+		// Delivers the message to the subscribers of this shard, encode(qos) returns the packet for a QoS level
+		template<class Encode>
+		void Route(const std::string& topic, uint8_t qos, Encode&& encode, std::chrono::steady_clock::time_point received = {});
+
+		// Delivers the message to one member of every matching shared group, the member may be on any shard
+		template<class Encode>
+		void RouteShared(const std::string& topic, uint8_t qos, Encode&& encode, uint64_t publisher);
+
+		// Changes the copy of the shared groups of this shard, Server::Share changes all of them
+		void Join(const std::string& group, const std::string& filter, const SharedMember& member);
+		void Leave(const std::string& group, const std::string& filter, size_t shard, uint32_t handle);
+
+		// Adds the session to the subscribers of the filter, false if it was there and only its QoS was changed
+		bool Subscribe(const std::string& filter, uint32_t handle, uint8_t qos, SubscriptionRef* ref);
+
+		// Removes the session from the node, a node without subscribers and children is removed with it
+		void Unsubscribe(const SubscriptionRef& ref, uint32_t handle);
+
+		// kNoNode if nobody has subscribed to the filter
+		subscription_node FindNode(const std::string& filter);
+
+		// Can be called from any thread
+		void Post(std::shared_ptr<const Publication> pub);
+
+		// Sends the $SYS values to the subscribers of this shard
+		void PublishSys(const std::vector<std::pair<std::string, std::string>>& topics);
+
+		// Every shard keeps its own copy of the retained messages, the packets themselves are shared
+		void Retain(const Publication& pub);
+
+		// A message for a handle that is stale is dropped
+		void SendMessageTo(uint32_t handle, shared_bytes msg, std::chrono::steady_clock::time_point queued);
+
+		// Free sessions are reused by new connections
+		void ReleaseSession(std::shared_ptr<Session> session);
+		std::shared_ptr<Session> AcquireFreeSession();
+
+		size_t SessionSize() const { return session_count_.load(std::memory_order_relaxed); }
+		size_t GetIndex() const { return index_; }
+
+		// One line of counters for every session of the shard
+		std::string DescribeSessions() const;
+
+		asio::io_context io;
+
+		subscriptions_tree topics_;
+		ClientTable clients_;
+
+		retained_tree retained_;
+
+		// Walks over retained_ that are not finished, nodes are not removed while there are any
+		void BeginReplay() { replaying_++; }
+		void EndReplay(size_t walks = 1);
+
+		ShardMetrics metrics;
+		Admission admission; // of the CONNECT packets read by this shard
+
+	private:
+		void DrainInbox();
+		tree::subscriber_set& Subscribers(subscription_node node);
+
+		size_t index_;
+
+		size_t replaying_ = 0;
+		std::vector<std::string> cleared_; // topics whose retained message was removed during a walk
+
+		std::list<std::shared_ptr<Session>> sessions_;
+		std::vector<std::shared_ptr<Session>> free_sessions_;
+		std::atomic<size_t> session_count_ = 0;
+
+		shared_tree shared_;
+
+		MpscQueue<std::shared_ptr<const Publication>> inbox_;
+		std::atomic<bool> inbox_scheduled_ = false;
+	};
+
+	class Server {
+	public:
+
+		// Creates the shards, must be called before everything else
+		void Init(size_t threads);
+
+		// Must be called before Run, the limits are read by all shards without a lock
+		void SetQueueLimits(const QueueLimits& limits) { limits_ = limits; }
+		const QueueLimits& GetQueueLimits() const { return limits_; }
+
+		// Persistent sessions are written to the store if it is set, must be called before Run
+		void SetStore(Store* store) { store_ = store; }
+		Store* GetStore() const { return store_; }
+
+		// Brings back the sessions of the store, must be called before Run
+		void Restore();
+
+		// Runs the shards, the calling thread serves the first one
+		void Run();
+		void Stop();
+
+		// Budget of CONNECT packets per second of all shards, 0 is no limit, must be called before Run
+		void SetConnectRate(double per_second);
+
+		// Accepts connections on every shard, returns the endpoint that was bound
+		tcp::endpoint Listen(const tcp::endpoint& endpoint);
+
+		// Routes the publication to all shards, starting with the shard of the publisher
+		void Publish(Shard& from, const mqtt::PublishView& src, std::chrono::steady_clock::time_point received = {},
+			uint64_t publisher = 0);
+
+		// Must be called before Run
+		void SetShareStrategy(kShareStrategy strategy) { share_strategy_ = strategy; }
+		kShareStrategy GetShareStrategy() const { return share_strategy_; }
+
+		// Adds or removes a member of a shared subscription on every shard, the shard of the caller at once
+		void Share(Shard& from, const std::string& group, const std::string& filter, const SharedMember& member);
+		void Unshare(Shard& from, const std::string& group, const std::string& filter, uint32_t handle);
+
+		std::shared_ptr<Session> GetSession(const std::string& client_id);
+
+		// Index of connected clients of all shards, a session is registered after CONNECT
+		void RegisterSession(const std::string& client_id, std::shared_ptr<Session> session);
+		void UnregisterSession(const std::string& client_id, Session* session);
+
+		// Gives the socket to a session that may belong to another shard
+		void TransferSession(Shard& from, std::shared_ptr<Session> session, tcp::socket sock);
+
+		// Ends the session on its own shard, when the client connects with clean session = 1
+		void DiscardSession(std::shared_ptr<Session> session);
+
+		Shard& GetShard(size_t index) { return *shards_[index]; }
+		size_t ShardSize() const { return shards_.size(); }
+
+		size_t SessionSize();
+
+		// Sums the metrics of the shards, can be called from any thread
+		MetricsSnapshot CollectMetrics();
+
+		// Publishes the metrics to $SYS/broker/... every interval, runs on the first shard
+		asio::awaitable<void> PublishMetrics(std::chrono::seconds interval);
+
+		// Writes the metrics and the counters of every session as text to each connection and closes it
+		asio::awaitable<void> ServeMetrics(tcp::acceptor acceptor);
+
+	private:
+		// The registry is split into stripes, so connecting clients rarely wait for each other
+		struct Stripe {
+			std::mutex mutex;
+			std::unordered_map<std::string, std::shared_ptr<Session>> clients;
+		};
+
+		Stripe& GetStripe(const std::string& client_id);
+
+		asio::awaitable<void> Accept(std::shared_ptr<tcp::acceptor> acceptor, Shard& shard);
+
+		std::vector<std::unique_ptr<Shard>> shards_;
+		std::array<Stripe, 64> registry_;
+		QueueLimits limits_;
+		kShareStrategy share_strategy_ = kShareRoundRobin;
+		Store* store_ = nullptr;
+		std::chrono::steady_clock::time_point started_;
+		std::atomic<unsigned int> next_session_id_ = 1;
+	};
+
+	extern Server server;
+
+	/*
+	*  Packet taken by the writer.
+	*  A QoS 1 or 2 PUBLISH is shared by all subscribers, so its first byte and packet id
+	*  are kept here and written in separate buffers around the shared bytes.
+	*  Acknowledgements are short enough to be kept here without a packet at all
+	*/
+	struct OutFrame {
+		shared_bytes packet; // nullptr for a short packet kept in head
+		uint16_t id = 0;     // packet id of a PUBLISH, head[0] is its first byte
+		std::array<uint8_t, 4> head{};
+		uint8_t head_len = 0;
+		std::chrono::steady_clock::time_point queued{}; // set for the messages of the queue, the write latency starts here
+
+		size_t Size() const { return packet ? packet->size() : head_len; }
+		size_t Buffers() const { return id != 0 ? 4 : 1; }
+	};
+
+	// Message in the outgoing queue of a session
+	struct QueuedMessage {
+		shared_bytes packet;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	class Session : public std::enable_shared_from_this<Session> {
+	public:
+		Session(tcp::socket sock, unsigned int id_of_session, Shard& shard);
+		void Start();
+		// Queues a message for the client, the limits of the queue decide if it is kept
+		void RewriteBuffer(shared_bytes msg, std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now());
+		QueueStats GetQueueStats() const;
+		const SessionMetrics& GetMetrics() const { return metrics_; }
+
+		// Messages in the outgoing queue, can be read from any thread
+		size_t QueueDepth() const { return depth_.load(std::memory_order_relaxed); }
+
+		// Names the client in the subscriptions of its shard from CONNECT to the end of the session
+		uint32_t GetHandle() const { return handle_; }
+		bool Connected() const { return sock_.is_open(); }
+		const std::string& GetId() const;
+		unsigned int GetSessionId();
+		Shard& GetShard() { return shard_; }
+		void TransferControl(tcp::socket sock);
+		void CleanSessionHandler();
+		bool SessionIsFree();
+		void MarkFree();
+		void SendWillMessage();
+		void Restore(const StoredClient& stored);
+		void Discard();
+
+		// The reverse index of the subscriptions, EndSession removes exactly these
+		void AddSubscription(const SubscriptionRef& ref) { subscriptions_.push_back(ref); }
+		void AddSharedSubscription(std::string filter) { shared_filters_.push_back(std::move(filter)); }
+
+		// clean session = 0, the session outlives the connection
+		bool Persistent() const { return persistent_.load(std::memory_order_relaxed); }
+
+		asio::awaitable<void> ReadBytes();
+		asio::awaitable<void> SendBytes();
+		
+		int PacketHandler(uint8_t* packet, size_t size);
+
+		int ConnectHandler(mqtt::Connect*);
+		int DisconnectHandler();
+		int SubscribeHandler(mqtt::Subscribe*);
+		int UnsubscribeHandler(mqtt::Unsubscribe*);
+		int PublishHandler(mqtt::PublishView*);
+		int PubackHandler(mqtt::Puback*);
+		int PubrecHandler(mqtt::Pubrec*);
+		int PubrelHandler(mqtt::Pubrel*);
+		int PubcompHandler(mqtt::Pubcomp*);
+		int PingreqHandler();
+
+		void Stop(bool delete_session = false);
+		void EndSession();
+
+		~Session();
+	private:
+		Shard& shard_;
+		tcp::socket sock_;
+		asio::steady_timer timer_for_send;
+		asio::steady_timer timer_for_ping;
+		asio::steady_timer timer_for_retry;
+
+		// Control packets bypass the limits and are sent before messages
+		void Enqueue(shared_bytes packet);
+		void EnqueueAck(uint8_t first, uint16_t pkt_id);
+		void EnqueueMessage(shared_bytes msg, std::chrono::steady_clock::time_point queued);
+		bool Fits(size_t len) const;
+		bool DropOldest(size_t len);
+		void Drop();
+		bool Spill(const shared_bytes& msg);
+		void Persist(const shared_bytes& msg);
+		void Unspill();
+		void ReplayRetained();
+		void ClearQueue();
+
+		// Moves packets from the queues to the batch of the writer, returns the number of bytes
+		size_t TakeBatch(std::vector<OutFrame>& frames);
+		void Written(const std::vector<OutFrame>& frames, size_t bytes);
+		void ScheduleRetry();
+		void Retransmit(std::chrono::steady_clock::time_point deadline);
+		int Acknowledge(uint16_t pkt_id, InflightWindow::kState state);
+
+		ReceiveBuffer buf_;
+		std::deque<OutFrame> control_;
+		std::deque<QueuedMessage> packets_;
+		std::deque<uint16_t> retransmit_;
+		std::unique_ptr<InflightWindow> inflight_; // created by the first QoS 1 or 2 message
+		size_t queued_bytes_ = 0;
+		size_t dropped_ = 0;
+		bool dropping_ = false; // a warning is logged once per overload
+		std::unique_ptr<SpillFile> spill_;
+
+		SessionMetrics metrics_;
+		std::atomic<size_t> depth_ = 0; // packets_.size() for other threads
+		uint32_t handle_ = kNoHandle;
+		std::vector<SubscriptionRef> subscriptions_;
+		std::vector<std::string> shared_filters_; // "$share/{group}/{filter}" as subscribed
+		std::chrono::steady_clock::time_point received_; // the last read, PUBLISH packets of the read take it
+
+		// retained messages of new subscriptions that are not queued yet
+		struct Replay {
+			retained_tree::filter_cursor cursor;
+			uint8_t qos;
+		};
+		std::deque<Replay> replays_;
+		std::deque<Replay> paused_; // replays_ of the persistent session while the client is away, from the start again
+
+		// sequence numbers of the stored messages that have not reached the in-flight window, in queue order
+		std::deque<uint64_t> stored_;
+		uint64_t stored_seq_ = 0;
+		std::atomic<bool> persistent_ = false; // read by other shards when the client connects again
+		Client cl;
+
+		bool session_is_available;
+		size_t len_of_packet_ = 0;
+
+		unsigned int id_of_session_;
+		unsigned int generation_ = 0; // incremented each time the session gets a connection
+	};
+	
+} //namespace network
+
+#endif 
+
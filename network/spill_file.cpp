@@ -0,0 +1,57 @@
+#include "spill_file.hpp"
+
+network::SpillFile::~SpillFile() {
+	if (file_ != nullptr) {
+		std::fclose(file_);
+	}
+}
+
+bool network::SpillFile::Push(const std::vector<uint8_t>& packet) {
+	if (file_ == nullptr && (file_ = std::tmpfile()) == nullptr) {
+		return false;
+	}
+
+	// every record is the length of the packet followed by the packet
+	uint32_t len = uint32_t(packet.size());
+
+	if (std::fseek(file_, write_pos_, SEEK_SET) != 0
+		|| std::fwrite(&len, sizeof(len), 1, file_) != 1
+		|| std::fwrite(packet.data(), 1, len, file_) != len) {
+		return false;
+	}
+
+	write_pos_ += long(sizeof(len) + len);
+	count_++;
+	return true;
+}
+
+shared_bytes network::SpillFile::Pop() {
+	if (count_ == 0) {
+		return nullptr;
+	}
+
+	uint32_t len = 0;
+
+	if (std::fflush(file_) != 0
+		|| std::fseek(file_, read_pos_, SEEK_SET) != 0
+		|| std::fread(&len, sizeof(len), 1, file_) != 1) {
+		return nullptr;
+	}
+
+	std::vector<uint8_t> packet(len);
+
+	if (std::fread(packet.data(), 1, len, file_) != len) {
+		return nullptr;
+	}
+
+	read_pos_ += long(sizeof(len) + len);
+	count_--;
+
+	// the space is used again from the beginning once everything has been read
+	if (count_ == 0) {
+		read_pos_ = 0;
+		write_pos_ = 0;
+	}
+
+	return std::make_shared<const std::vector<uint8_t>>(std::move(packet));
+}
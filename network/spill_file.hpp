@@ -0,0 +1,45 @@
+#ifndef MQTT_NETWORK_SPILL_FILE_H_
+#define MQTT_NETWORK_SPILL_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "../utility/mqtt.hpp"
+
+namespace network {
+
+	/*
+	*  Queue of packets kept in an anonymous temporary file.
+	*  A session puts here the QoS 1 and 2 messages that do not fit into its
+	*  outgoing queue and takes them back when the queue has drained.
+	*  The file is created by the first Push and removed by the system when it is closed.
+	*/
+	class SpillFile {
+	public:
+		SpillFile() = default;
+		SpillFile(const SpillFile&) = delete;
+		SpillFile& operator=(const SpillFile&) = delete;
+		~SpillFile();
+
+		// Returns false if the packet could not be written
+		bool Push(const std::vector<uint8_t>& packet);
+
+		// Returns nullptr if the file is empty or could not be read
+		shared_bytes Pop();
+
+		bool Empty() const { return count_ == 0; }
+		size_t Size() const { return count_; }
+		size_t Bytes() const { return size_t(write_pos_ - read_pos_); }
+
+	private:
+		std::FILE* file_ = nullptr;
+		long read_pos_ = 0;
+		long write_pos_ = 0;
+		size_t count_ = 0;
+	};
+
+} // namespace network
+
+#endif
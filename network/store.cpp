@@ -0,0 +1,809 @@
+#include "store.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "log/log.hpp"
+
+namespace {
+
+	// length of the body and its checksum
+	constexpr size_t kRecordHeader = 2 * sizeof(uint32_t);
+
+	constexpr char kSnapshotMagic[8] = { 'M', 'Q', 'T', 'T', 'S', 'N', 'A', 'P' };
+
+	constexpr std::array<uint32_t, 256> MakeCrcTable() {
+		std::array<uint32_t, 256> table{};
+
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+		return table;
+	}
+
+	constexpr std::array<uint32_t, 256> kCrcTable = MakeCrcTable();
+
+	uint32_t Crc32(const uint8_t* data, size_t len) {
+		uint32_t crc = 0xFFFFFFFFu;
+
+		for (size_t i = 0; i < len; i++) {
+			crc = kCrcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return crc ^ 0xFFFFFFFFu;
+	}
+
+	// Reads the fields of a record and fails on the first one that does not fit
+	class Reader {
+	public:
+		Reader(const uint8_t* data, size_t len) : data_(data), len_(len) {}
+
+		template<class T>
+		bool Get(T& value) {
+			if (len_ - pos_ < sizeof(T)) {
+				return false;
+			}
+			std::memcpy(&value, data_ + pos_, sizeof(T));
+			pos_ += sizeof(T);
+			return true;
+		}
+
+		bool Get(std::string_view& value, size_t len) {
+			if (len_ - pos_ < len) {
+				return false;
+			}
+			value = std::string_view(reinterpret_cast<const char*>(data_ + pos_), len);
+			pos_ += len;
+			return true;
+		}
+
+		bool Done() const { return pos_ == len_; }
+		size_t Pos() const { return pos_; }
+
+	private:
+		const uint8_t* data_;
+		size_t len_;
+		size_t pos_ = 0;
+	};
+
+	bool ReadFile(const std::filesystem::path& path, std::vector<uint8_t>& data) {
+		std::FILE* file = std::fopen(path.string().c_str(), "rb");
+
+		if (file == nullptr) {
+			return false;
+		}
+
+		std::error_code ec;
+		data.resize(size_t(std::filesystem::file_size(path, ec)));
+
+		bool ok = !ec && std::fread(data.data(), 1, data.size(), file) == data.size();
+		std::fclose(file);
+		return ok;
+	}
+
+	// The snapshot is only read, so it is mapped instead of copied into a buffer first
+	class MappedFile {
+	public:
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+			ok_ = ReadFile(path, buffer_);
+			data_ = buffer_.data();
+			size_ = buffer_.size();
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			struct stat st;
+
+			if (fd < 0 || ::fstat(fd, &st) != 0) {
+				if (fd >= 0) {
+					::close(fd);
+				}
+				return;
+			}
+
+			size_ = size_t(st.st_size);
+			ok_ = true;
+
+			if (size_ != 0) {
+				void* map = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+				if (map == MAP_FAILED) {
+					ok_ = false;
+				}
+				else {
+					data_ = static_cast<const uint8_t*>(map);
+					::madvise(map, size_, MADV_SEQUENTIAL);
+				}
+			}
+			::close(fd);
+#endif
+		}
+
+		~MappedFile() {
+#ifndef _WIN32
+			if (data_ != nullptr) {
+				::munmap(const_cast<uint8_t*>(data_), size_);
+			}
+#endif
+		}
+
+		bool Ok() const { return ok_; }
+		const uint8_t* Data() const { return data_; }
+		size_t Size() const { return size_; }
+
+	private:
+		bool ok_ = false;
+		const uint8_t* data_ = nullptr;
+		size_t size_ = 0;
+#ifdef _WIN32
+		std::vector<uint8_t> buffer_;
+#endif
+	};
+
+	// "wal-N.log" gives N
+	bool WalId(const std::filesystem::path& path, uint64_t& id) {
+		std::string name = path.filename().string();
+
+		if (name.size() <= 8 || name.compare(0, 4, "wal-") != 0 || name.compare(name.size() - 4, 4, ".log") != 0) {
+			return false;
+		}
+
+		std::string digits = name.substr(4, name.size() - 8);
+
+		if (!std::all_of(digits.begin(), digits.end(), [](char ch) { return ch >= '0' && ch <= '9'; })) {
+			return false;
+		}
+
+		id = std::stoull(digits);
+		return true;
+	}
+}
+
+network::Store::~Store() {
+	Close();
+}
+
+bool network::Store::Open(const StoreOptions& options) {
+	options_ = options;
+
+	std::error_code ec;
+	std::filesystem::create_directories(options_.dir, ec);
+
+	if (ec) {
+		Log(error, 0, "The store directory can not be created: " + ec.message());
+		return false;
+	}
+
+	uint64_t next_wal = 0;
+	bool has_snapshot = false;
+
+	if (std::filesystem::exists(SnapshotPath())) {
+		MappedFile snapshot{ SnapshotPath() };
+		size_t header = sizeof(kSnapshotMagic) + sizeof(next_wal);
+
+		if (!snapshot.Ok() || snapshot.Size() < header) {
+			Log(error, 0, "The snapshot of the store can not be read");
+			return false;
+		}
+
+		const uint8_t* data = snapshot.Data();
+		size_t len = snapshot.Size();
+
+		if (std::memcmp(data, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0) {
+			Log(error, 0, "The snapshot of the store can not be read");
+			return false;
+		}
+
+		std::memcpy(&next_wal, data + sizeof(kSnapshotMagic), sizeof(next_wal));
+
+		size_t tables = LoadTables(data + header, len - header);
+
+		// the snapshot is renamed into place only after it is synced, so it is never cut
+		if (tables == 0 || Apply(data + header + tables, len - header - tables) != len - header - tables) {
+			Log(error, 0, "The snapshot of the store is damaged");
+			return false;
+		}
+		snapshot_bytes_ = len;
+		has_snapshot = true;
+	}
+
+	std::vector<uint8_t> data;
+
+	std::vector<uint64_t> logs;
+
+	for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+		uint64_t id;
+
+		if (WalId(entry.path(), id) && id >= next_wal) {
+			logs.push_back(id);
+		}
+	}
+	std::sort(logs.begin(), logs.end());
+
+	for (uint64_t id : logs) {
+		if (!ReadFile(WalPath(id), data)) {
+			Log(error, 0, "The log of the store can not be read: " + WalPath(id));
+			return false;
+		}
+
+		// a crash can cut the last group of records, everything before it is kept
+		size_t applied = Apply(data.data(), data.size());
+
+		if (applied != data.size()) {
+			Log(warning, 0, "The log " + WalPath(id) + " ends with a damaged record after "
+				+ std::to_string(applied) + " bytes, the rest of the log is ignored");
+			break;
+		}
+	}
+
+	wal_id_ = logs.empty() ? next_wal : logs.back() + 1;
+
+	// nothing to replay, the snapshot is already the whole state
+	if (logs.empty() && has_snapshot) {
+		return OpenWal();
+	}
+
+	// the recovered state becomes the new snapshot and the replayed logs are removed
+	return Compact();
+}
+
+void network::Store::Start() {
+	std::lock_guard lock{ mutex_ };
+
+	if (running_ || wal_ == nullptr) {
+		return;
+	}
+
+	running_ = true;
+	thread_ = std::thread([this] { Run(); });
+}
+
+void network::Store::Close() {
+	{
+		std::lock_guard lock{ mutex_ };
+		running_ = false;
+	}
+	cv_.notify_one();
+
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+
+	if (wal_ != nullptr) {
+		Sync(wal_);
+		std::fclose(wal_);
+		wal_ = nullptr;
+	}
+}
+
+void network::Store::AddSession(std::string_view client_id) {
+	EndRecord(BeginRecord(kAddSession, client_id));
+}
+
+void network::Store::RemoveSession(std::string_view client_id) {
+	EndRecord(BeginRecord(kRemoveSession, client_id));
+}
+
+void network::Store::Subscribe(std::string_view client_id, std::string_view topic, uint8_t qos) {
+	std::vector<uint8_t>& record = BeginRecord(kSubscribe, client_id);
+	uint16_t len = uint16_t(topic.size());
+
+	Put(record, &qos, sizeof(qos));
+	Put(record, &len, sizeof(len));
+	Put(record, topic.data(), topic.size());
+	EndRecord(record);
+}
+
+void network::Store::Unsubscribe(std::string_view client_id, std::string_view topic) {
+	std::vector<uint8_t>& record = BeginRecord(kUnsubscribe, client_id);
+	uint16_t len = uint16_t(topic.size());
+
+	Put(record, &len, sizeof(len));
+	Put(record, topic.data(), topic.size());
+	EndRecord(record);
+}
+
+void network::Store::AddMessage(std::string_view client_id, uint64_t seq, const std::vector<uint8_t>& packet) {
+	std::vector<uint8_t>& record = BeginRecord(kAddMessage, client_id);
+	uint32_t len = uint32_t(packet.size());
+
+	Put(record, &seq, sizeof(seq));
+	Put(record, &len, sizeof(len));
+	Put(record, packet.data(), packet.size());
+	EndRecord(record);
+}
+
+void network::Store::RemoveMessage(std::string_view client_id, uint64_t seq) {
+	std::vector<uint8_t>& record = BeginRecord(kRemoveMessage, client_id);
+
+	Put(record, &seq, sizeof(seq));
+	EndRecord(record);
+}
+
+/*
+*  Record: length of the body, CRC-32 of the body, then the body itself:
+*  type, length of the client id, client id and the fields of the type
+*/
+std::vector<uint8_t>& network::Store::BeginRecord(kRecord type, std::string_view client_id) {
+	thread_local std::vector<uint8_t> record;
+	uint16_t len = uint16_t(client_id.size());
+
+	record.assign(kRecordHeader, 0);
+	record.push_back(type);
+	Put(record, &len, sizeof(len));
+	Put(record, client_id.data(), client_id.size());
+
+	return record;
+}
+
+void network::Store::Put(std::vector<uint8_t>& record, const void* data, size_t len) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	record.insert(record.end(), bytes, bytes + len);
+}
+
+void network::Store::FinishRecord(std::vector<uint8_t>& record) {
+	uint32_t len = uint32_t(record.size() - kRecordHeader);
+	uint32_t crc = Crc32(record.data() + kRecordHeader, len);
+
+	std::memcpy(record.data(), &len, sizeof(len));
+	std::memcpy(record.data() + sizeof(len), &crc, sizeof(crc));
+}
+
+// The checksum is computed before the lock is taken, under the lock the record is only copied
+void network::Store::EndRecord(std::vector<uint8_t>& record) {
+	FinishRecord(record);
+
+	bool was_empty;
+	{
+		std::lock_guard lock{ mutex_ };
+
+		was_empty = pending_.empty();
+		pending_.insert(pending_.end(), record.begin(), record.end());
+	}
+
+	// the writer sleeps only when there is nothing to write
+	if (was_empty) {
+		cv_.notify_one();
+	}
+}
+
+size_t network::Store::Apply(const uint8_t* data, size_t len) {
+	size_t pos = 0;
+
+	while (len - pos >= kRecordHeader) {
+		uint32_t body_len, crc;
+
+		std::memcpy(&body_len, data + pos, sizeof(body_len));
+		std::memcpy(&crc, data + pos + sizeof(body_len), sizeof(crc));
+
+		if (len - pos - kRecordHeader < body_len) {
+			break;
+		}
+
+		const uint8_t* body = data + pos + kRecordHeader;
+
+		if (Crc32(body, body_len) != crc) {
+			break;
+		}
+
+		Reader reader{ body, body_len };
+		uint8_t type;
+		uint16_t client_len;
+		std::string_view client_id;
+
+		if (!reader.Get(type) || !reader.Get(client_len) || !reader.Get(client_id, client_len)) {
+			break;
+		}
+
+		std::string id{ client_id };
+		auto found = client_index_.find(id);
+		bool ok = false;
+
+		switch (type) {
+		case kAddSession:
+			AddClient(id);
+			ok = true;
+			break;
+		case kRemoveSession:
+			if (found != client_index_.end()) {
+				uint32_t c = found->second;
+
+				for (uint32_t n : clients_[c].nodes) {
+					RemoveSubscriber(c, n);
+				}
+
+				clients_[c] = StoredClient{};
+				free_clients_.push_back(c);
+				client_index_.erase(found);
+			}
+			ok = true;
+			break;
+		case kSubscribe: {
+			uint8_t qos;
+			uint16_t topic_len;
+			std::string_view topic;
+
+			if ((ok = reader.Get(qos) && reader.Get(topic_len) && reader.Get(topic, topic_len))) {
+				uint32_t c = AddClient(id);
+				uint32_t n = subscriptions_.node_of(topic);
+				std::vector<StoredSubscriber>& subscribers = subscriptions_.at(n);
+				auto it = std::find_if(subscribers.begin(), subscribers.end(), [c](const StoredSubscriber& s) { return s.client == c; });
+
+				if (it != subscribers.end()) {
+					it->qos = qos;
+				}
+				else {
+					subscribers.push_back(StoredSubscriber{ c, qos });
+					clients_[c].nodes.push_back(n);
+				}
+			}
+			break;
+		}
+		case kUnsubscribe: {
+			uint16_t topic_len;
+			std::string_view topic;
+
+			if ((ok = reader.Get(topic_len) && reader.Get(topic, topic_len)) && found != client_index_.end()) {
+				uint32_t c = found->second;
+				uint32_t n = subscriptions_.find_node(topic);
+				std::vector<uint32_t>& nodes = clients_[c].nodes;
+
+				if (auto it = std::find(nodes.begin(), nodes.end(), n); n != stored_tree::none && it != nodes.end()) {
+					*it = nodes.back();
+					nodes.pop_back();
+					RemoveSubscriber(c, n);
+				}
+			}
+			break;
+		}
+		case kAddMessage: {
+			uint64_t seq;
+			uint32_t packet_len;
+			std::string_view packet;
+
+			// the old shard of a client may still queue a message after the new one has removed the session
+			if ((ok = reader.Get(seq) && reader.Get(packet_len) && reader.Get(packet, packet_len)) && found != client_index_.end()) {
+				clients_[found->second].messages[seq].assign(packet.begin(), packet.end());
+			}
+			break;
+		}
+		case kRemoveMessage: {
+			uint64_t seq;
+
+			if ((ok = reader.Get(seq)) && found != client_index_.end()) {
+				clients_[found->second].messages.erase(seq);
+			}
+			break;
+		}
+		}
+
+		if (!ok || !reader.Done()) {
+			break;
+		}
+
+		pos += kRecordHeader + body_len;
+	}
+
+	return pos;
+}
+
+uint32_t network::Store::AddClient(const std::string& client_id) {
+	auto [it, added] = client_index_.try_emplace(client_id, 0);
+
+	if (!added) {
+		return it->second;
+	}
+
+	if (free_clients_.empty()) {
+		it->second = uint32_t(clients_.size());
+		clients_.emplace_back();
+	}
+	else {
+		it->second = free_clients_.back();
+		free_clients_.pop_back();
+	}
+
+	StoredClient& client = clients_[it->second];
+	client.id = client_id;
+	client.active = true;
+	return it->second;
+}
+
+// Nodes left without subscribers and children are removed, so the trie does not keep old topics forever
+void network::Store::RemoveSubscriber(uint32_t client, uint32_t node) {
+	std::vector<StoredSubscriber>& subscribers = subscriptions_.at(node);
+	auto it = std::find_if(subscribers.begin(), subscribers.end(), [client](const StoredSubscriber& s) { return s.client == client; });
+
+	if (it != subscribers.end()) {
+		*it = subscribers.back();
+		subscribers.pop_back();
+	}
+
+	subscriptions_.prune(node, [](const std::vector<StoredSubscriber>& s) { return s.empty(); });
+}
+
+/*
+*  Tables of a snapshot: the number of clients and their ids, then the image of the trie
+*  where every node has the number of its subscribers and (client, qos) of each of them.
+*  Clients are numbered again without the free slots
+*/
+void network::Store::SaveTables(std::vector<uint8_t>& out) const {
+	std::vector<uint32_t> numbers(clients_.size(), 0);
+	uint64_t count = 0;
+	size_t start = out.size();
+
+	out.insert(out.end(), sizeof(count), 0);
+
+	for (uint32_t c = 0; c < clients_.size(); c++) {
+		if (!clients_[c].active) {
+			continue;
+		}
+
+		uint16_t len = uint16_t(clients_[c].id.size());
+		numbers[c] = uint32_t(count++);
+		Put(out, &len, sizeof(len));
+		Put(out, clients_[c].id.data(), clients_[c].id.size());
+	}
+	std::memcpy(out.data() + start, &count, sizeof(count));
+
+	subscriptions_.save(out, [&numbers](std::vector<uint8_t>& image, const std::vector<StoredSubscriber>& subscribers) {
+		uint32_t size = uint32_t(subscribers.size());
+		Put(image, &size, sizeof(size));
+
+		for (const StoredSubscriber& s : subscribers) {
+			Put(image, &numbers[s.client], sizeof(s.client));
+			Put(image, &s.qos, sizeof(s.qos));
+		}
+	});
+}
+
+size_t network::Store::LoadTables(const uint8_t* data, size_t len) {
+	Reader reader{ data, len };
+	uint64_t count;
+
+	if (!reader.Get(count)) {
+		return 0;
+	}
+
+	for (uint64_t c = 0; c < count; c++) {
+		uint16_t id_len;
+		std::string_view id;
+
+		if (!reader.Get(id_len) || !reader.Get(id, id_len)) {
+			return 0;
+		}
+		AddClient(std::string{ id });
+	}
+
+	if (clients_.size() != count) {
+		return 0;
+	}
+
+	constexpr size_t kSubscriber = sizeof(uint32_t) + sizeof(uint8_t);
+	size_t pos = reader.Pos();
+
+	bool ok = subscriptions_.load(data, len, pos, [count](stored_tree::image_reader& image, std::vector<StoredSubscriber>& subscribers) {
+		uint32_t size;
+
+		if (!image.get(&size, sizeof(size)) || image.left() / kSubscriber < size) {
+			return false;
+		}
+
+		subscribers.resize(size);
+
+		for (StoredSubscriber& s : subscribers) {
+			image.get(&s.client, sizeof(s.client));
+			image.get(&s.qos, sizeof(s.qos));
+
+			if (s.client >= count) {
+				return false;
+			}
+		}
+		return true;
+	});
+
+	if (!ok) {
+		return 0;
+	}
+
+	// the nodes of every client are found in one pass over the trie
+	for (uint32_t n = 0; n < subscriptions_.capacity(); n++) {
+		for (const StoredSubscriber& s : subscriptions_.at(n)) {
+			clients_[s.client].nodes.push_back(n);
+		}
+	}
+	return pos;
+}
+
+/*
+*  Group commit: the records gathered while the previous group was written go out together.
+*  With kFsyncInterval the log is synced when the interval has passed, or when the writer
+*  has nothing to do and the interval ends, so a burst never waits for the disk per record
+*/
+void network::Store::Run() {
+	std::vector<uint8_t> batch;
+	auto synced = std::chrono::steady_clock::now();
+	bool unsynced = false;
+
+	for (;;) {
+		{
+			std::unique_lock lock{ mutex_ };
+			auto ready = [this] { return !pending_.empty() || !running_; };
+
+			if (unsynced) {
+				cv_.wait_until(lock, synced + options_.interval, ready);
+			}
+			else {
+				cv_.wait(lock, ready);
+			}
+
+			if (pending_.empty() && !running_) {
+				break;
+			}
+			std::swap(batch, pending_);
+		}
+
+		if (!batch.empty()) {
+			// the records were built by this store, so all of them are applied
+			Apply(batch.data(), batch.size());
+
+			if (wal_ == nullptr || std::fwrite(batch.data(), 1, batch.size(), wal_) != batch.size() || std::fflush(wal_) != 0) {
+				Log(error, 0, "The log of the store can not be written");
+			}
+
+			wal_bytes_ += batch.size();
+			batch.clear();
+			unsynced = options_.fsync != kFsyncNever;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+
+		if (unsynced && (options_.fsync == kFsyncAlways || now - synced >= options_.interval)) {
+			if (!Sync(wal_)) {
+				Log(error, 0, "The log of the store can not be synced");
+			}
+			synced = now;
+			unsynced = false;
+		}
+
+		if (wal_bytes_ > std::max(options_.compact_bytes, snapshot_bytes_)) {
+			wal_id_++;
+
+			if (!Compact()) {
+				Log(error, 0, "The store can not be compacted");
+			}
+			unsynced = false;
+		}
+	}
+}
+
+bool network::Store::Compact() {
+	std::string tmp = SnapshotPath() + ".tmp";
+	std::FILE* file = std::fopen(tmp.c_str(), "wb");
+
+	if (file == nullptr) {
+		Log(error, 0, "The snapshot of the store can not be created: " + tmp);
+		return false;
+	}
+
+	bool ok = std::fwrite(kSnapshotMagic, 1, sizeof(kSnapshotMagic), file) == sizeof(kSnapshotMagic)
+		&& std::fwrite(&wal_id_, sizeof(wal_id_), 1, file) == 1;
+
+	size_t bytes = sizeof(kSnapshotMagic) + sizeof(wal_id_);
+
+	auto write = [&](std::vector<uint8_t>& record) {
+		FinishRecord(record);
+		ok = ok && std::fwrite(record.data(), 1, record.size(), file) == record.size();
+		bytes += record.size();
+	};
+
+	{
+		std::vector<uint8_t> tables;
+		SaveTables(tables);
+		ok = ok && std::fwrite(tables.data(), 1, tables.size(), file) == tables.size();
+		bytes += tables.size();
+	}
+
+	// the messages follow as records
+	for (const StoredClient& client : clients_) {
+		for (const auto& [seq, packet] : client.messages) {
+			std::vector<uint8_t>& record = BeginRecord(kAddMessage, client.id);
+			uint32_t len = uint32_t(packet.size());
+
+			Put(record, &seq, sizeof(seq));
+			Put(record, &len, sizeof(len));
+			Put(record, packet.data(), packet.size());
+			write(record);
+		}
+	}
+
+	ok = Sync(file) && ok;
+	std::fclose(file);
+
+	std::error_code ec;
+
+	if (ok) {
+		std::filesystem::rename(tmp, SnapshotPath(), ec);
+	}
+
+	if (!ok || ec) {
+		Log(error, 0, "The snapshot of the store can not be written");
+		return false;
+	}
+
+#ifndef _WIN32
+	// the rename itself reaches the disk only with the directory
+	if (int dir = ::open(options_.dir.c_str(), O_RDONLY); dir >= 0) {
+		::fsync(dir);
+		::close(dir);
+	}
+#endif
+
+	snapshot_bytes_ = bytes;
+
+	return OpenWal();
+}
+
+// The logs before wal_id_ are in the snapshot, they are removed and the log wal_id_ is started
+bool network::Store::OpenWal() {
+	if (wal_ != nullptr) {
+		std::fclose(wal_);
+	}
+
+	std::error_code ec;
+
+	for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+		uint64_t id;
+
+		if (WalId(entry.path(), id) && id < wal_id_) {
+			std::filesystem::remove(entry.path(), ec);
+		}
+	}
+
+	wal_ = std::fopen(WalPath(wal_id_).c_str(), "ab");
+	wal_bytes_ = 0;
+
+	if (wal_ == nullptr) {
+		Log(error, 0, "The log of the store can not be created: " + WalPath(wal_id_));
+		return false;
+	}
+	return true;
+}
+
+bool network::Store::Sync(std::FILE* file) {
+	if (file == nullptr || std::fflush(file) != 0) {
+		return false;
+	}
+
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return ::fsync(fileno(file)) == 0;
+#endif
+}
+
+std::string network::Store::WalPath(uint64_t id) const {
+	return (std::filesystem::path(options_.dir) / ("wal-" + std::to_string(id) + ".log")).string();
+}
+
+std::string network::Store::SnapshotPath() const {
+	return (std::filesystem::path(options_.dir) / "snapshot").string();
+}
@@ -0,0 +1,154 @@
+#ifndef MQTT_NETWORK_STORE_H_
+#define MQTT_NETWORK_STORE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../utility/flat_trie.hpp"
+
+namespace network {
+
+	enum kFsyncPolicy {
+		kFsyncNever,    // the system decides when the log reaches the disk
+		kFsyncInterval, // the log is synced at most once per interval
+		kFsyncAlways    // every group of records is synced before the next group is written
+	};
+
+	struct StoreOptions {
+		std::string dir;
+		kFsyncPolicy fsync = kFsyncInterval;
+		std::chrono::milliseconds interval{ 100 };
+		size_t compact_bytes = 64 * 1024 * 1024; // the log is compacted into a snapshot when it is bigger
+	};
+
+	// Subscription of a stored client, kept at the node of its topic filter
+	struct StoredSubscriber {
+		uint32_t client; // index in Store::Clients()
+		uint8_t qos;
+	};
+
+	// Persistent session as it is kept on disk
+	struct StoredClient {
+		std::string id;
+		bool active = false;                               // false for a free slot
+		std::vector<uint32_t> nodes;                       // nodes of the subscriptions in Store::Subscriptions()
+		std::map<uint64_t, std::vector<uint8_t>> messages; // undelivered QoS 1 and 2 PUBLISH by sequence number
+	};
+
+	typedef tree::flat_trie<std::vector<StoredSubscriber>> stored_tree;
+
+	/*
+	*  Durable state of the sessions with clean session = 0.
+	*  Every change is a record appended to a write-ahead log. Shards only copy the record
+	*  into a shared buffer, the writer thread takes everything gathered since its last write
+	*  and writes it at once, so many changes share one write and one fsync.
+	*  When the log grows past compact_bytes, the state is written into a snapshot
+	*  and a new log is started.
+	*
+	*  The directory holds "snapshot" and "wal-N.log". On startup the snapshot is loaded,
+	*  the logs after it are replayed up to the first damaged record and a new snapshot is written.
+	*  Numbers are in host byte order, like in the spill file.
+	*
+	*  Subscriptions are kept in a trie of the same shape as the trie of a shard, and the snapshot
+	*  holds its arrays as they are. Loading it is a few bulk copies out of the mapped file,
+	*  and every shard takes its tree with one more copy instead of inserting the topics one by one.
+	*/
+	class Store {
+	public:
+		Store() = default;
+		Store(const Store&) = delete;
+		Store& operator=(const Store&) = delete;
+		~Store();
+
+		// Recovers the state from the directory, false if it can not be read or written
+		bool Open(const StoreOptions& options);
+
+		// Starts the writer thread, Clients() and Subscriptions() must not be used after this
+		void Start();
+
+		// Writes and syncs the records that are left and stops the writer thread
+		void Close();
+
+		const std::vector<StoredClient>& Clients() const { return clients_; }
+		const stored_tree& Subscriptions() const { return subscriptions_; }
+		size_t SessionSize() const { return client_index_.size(); }
+
+		// Can be called from any thread
+		void AddSession(std::string_view client_id);
+		void RemoveSession(std::string_view client_id);
+		void Subscribe(std::string_view client_id, std::string_view topic, uint8_t qos);
+		void Unsubscribe(std::string_view client_id, std::string_view topic);
+		void AddMessage(std::string_view client_id, uint64_t seq, const std::vector<uint8_t>& packet);
+		void RemoveMessage(std::string_view client_id, uint64_t seq);
+
+	private:
+		enum kRecord : uint8_t {
+			kAddSession = 1,
+			kRemoveSession,
+			kSubscribe,
+			kUnsubscribe,
+			kAddMessage,
+			kRemoveMessage
+		};
+
+		// A record is built in a buffer of the calling thread, EndRecord copies it to the pending records
+		static std::vector<uint8_t>& BeginRecord(kRecord type, std::string_view client_id);
+		static void Put(std::vector<uint8_t>& record, const void* data, size_t len);
+		static void FinishRecord(std::vector<uint8_t>& record);
+		void EndRecord(std::vector<uint8_t>& record);
+
+		// Applies the valid records at the beginning of data, returns the number of bytes they take
+		size_t Apply(const uint8_t* data, size_t len);
+
+		// Index of the client, a free slot is taken if there is no such client
+		uint32_t AddClient(const std::string& client_id);
+		void RemoveSubscriber(uint32_t client, uint32_t node);
+
+		// Reads the client table and the trie of a snapshot, returns the number of bytes they take or 0
+		size_t LoadTables(const uint8_t* data, size_t len);
+		void SaveTables(std::vector<uint8_t>& out) const;
+
+		void Run();
+
+		// Writes the state into a new snapshot, removes the older logs and starts the log wal_id_
+		bool Compact();
+		bool OpenWal();
+		bool Sync(std::FILE* file);
+
+		std::string WalPath(uint64_t id) const;
+		std::string SnapshotPath() const;
+
+		StoreOptions options_;
+
+		// used only by the writer thread after Start
+		std::vector<StoredClient> clients_;
+		std::unordered_map<std::string, uint32_t> client_index_;
+		std::vector<uint32_t> free_clients_;
+		stored_tree subscriptions_;
+
+		std::FILE* wal_ = nullptr;
+		uint64_t wal_id_ = 0;
+		size_t wal_bytes_ = 0;
+		size_t snapshot_bytes_ = 0; // a big state is not compacted more often than the log grows by its size
+
+		std::mutex mutex_;
+		std::condition_variable cv_;
+		std::vector<uint8_t> pending_;
+		bool running_ = false;
+
+		std::thread thread_;
+	};
+
+} // namespace network
+
+#endif
@@ -0,0 +1,810 @@
+#ifndef MQTT_CONTAINERS_FLAT_TRIE_H_
+#define MQTT_CONTAINERS_FLAT_TRIE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "trie.hpp"
+
+namespace tree {
+
+    // Arrays of the flat_trie do not depend on the data, so tries of different data can share their shape
+    struct flat_trie_node {
+        uint32_t parent = UINT32_MAX;
+        uint32_t segment = UINT32_MAX;
+        uint32_t first_child = UINT32_MAX;
+        uint32_t prev_sibling = UINT32_MAX;
+        uint32_t next_sibling = UINT32_MAX;
+        uint32_t plus_child = UINT32_MAX;
+        uint32_t hash_child = UINT32_MAX;
+    };
+
+    struct flat_trie_edge {
+        uint64_t key = UINT64_MAX; // parent << 32 | segment, UINT64_MAX is an empty slot
+        uint32_t child = UINT32_MAX;
+    };
+
+    struct flat_trie_segment_slot {
+        uint32_t id = UINT32_MAX;
+        uint32_t hash = 0;
+    };
+
+    /*
+    *  Trie with the same interface as tree::trie, but stored in a few flat arrays.
+    *  Topic levels are interned into 32-bit segment ids, nodes live in one vector
+    *  and are addressed by index, and children are found in one open-addressed
+    *  table keyed by (parent, segment). A walk over a topic touches a segment slot,
+    *  an edge slot and a node per level instead of a red-black tree of strings.
+    *  '+' and '#' children are kept in the node itself, so wildcard branches cost nothing
+    *  to check.
+    *
+    *  Pointers and references to data are invalidated by get() and insert() of new paths.
+    *  Node ids stay the same until the node is removed.
+    */
+    template<class T>
+    class flat_trie {
+        template<class U>
+        friend class flat_trie;
+
+        static constexpr uint32_t plus_segment = 0; // segment ids of the wildcards
+        static constexpr uint32_t hash_segment = 1;
+
+    public:
+        static constexpr uint32_t none = UINT32_MAX; // id of a node that does not exist
+
+        flat_trie() {
+            nodes_.push_back(node{});
+            data_.emplace_back();
+
+            segment_slots_.assign(16, segment_slot{});
+            edges_.assign(16, edge{});
+
+            intern("+");
+            intern("#");
+        }
+
+        void insert(std::string_view path, const T& data) {
+            get(path) = data;
+        }
+
+        void insert(std::string_view path, T&& data) {
+            get(path) = std::move(data);
+        }
+
+        //get element at specified path, missing nodes are created
+        T& get(std::string_view path) {
+            return data_[node_of(path)];
+        }
+
+        //id of the node at specified path, missing nodes are created
+        uint32_t node_of(std::string_view path) {
+            uint32_t n = 0;
+
+            for (std::string_view level : levels{ path }) {
+                uint32_t segment = intern(level);
+                uint32_t next = find_edge(n, segment);
+
+                if (next == none) {
+                    next = add_node(n, segment);
+                }
+                n = next;
+            }
+            return n;
+        }
+
+        //id of the node at specified path without creating nodes, none if there is no such path
+        uint32_t find_node(std::string_view path) const {
+            uint32_t n = 0;
+
+            for (std::string_view level : levels{ path }) {
+                uint32_t segment = find_segment(level);
+
+                if (segment == none || (n = find_edge(n, segment)) == none) {
+                    return none;
+                }
+            }
+            return n;
+        }
+
+        T& at(uint32_t n) { return data_[n]; }
+        const T& at(uint32_t n) const { return data_[n]; }
+
+        // the path of a node is put together from the segments up to the root
+        std::string path(uint32_t n) const {
+            std::vector<uint32_t> up;
+
+            for (; n != 0; n = nodes_[n].parent) {
+                up.push_back(nodes_[n].segment);
+            }
+
+            std::string result;
+
+            for (auto it = up.rbegin(); it != up.rend(); ++it) {
+                if (it != up.rbegin()) {
+                    result += '/';
+                }
+                result += names_[*it];
+            }
+            return result;
+        }
+
+        // number of node ids in use including the free ones, ids are below this
+        size_t capacity() const {
+            return nodes_.size();
+        }
+
+        //find element at specified path without creating nodes, nullptr if there is no such path
+        T* find(std::string_view path) {
+            uint32_t n = 0;
+
+            for (std::string_view level : levels{ path }) {
+                uint32_t segment = find_segment(level);
+
+                if (segment == none) {
+                    return nullptr;
+                }
+
+                n = find_edge(n, segment);
+
+                if (n == none) {
+                    return nullptr;
+                }
+            }
+            return &data_[n];
+        }
+
+        //remove element and everything below it
+        void remove(std::string_view path) {
+            uint32_t n = 0;
+
+            for (std::string_view level : levels{ path }) {
+                uint32_t segment = find_segment(level);
+
+                if (segment == none || (n = find_edge(n, segment)) == none) {
+                    return;
+                }
+            }
+
+            erase(n);
+        }
+
+        //remove node and everything below it, the root is kept
+        void erase(uint32_t n) {
+            if (n != 0) {
+                unlink(n);
+                remove_subtree(n);
+            }
+        }
+
+        //remove the node and then its parents while they have no children and empty(data) is true
+        template<class Empty>
+        void prune(uint32_t n, Empty&& empty) {
+            while (n != 0 && leaf(n) && empty(data_[n])) {
+                uint32_t up = nodes_[n].parent;
+                erase(n);
+                n = up;
+            }
+        }
+
+        uint32_t parent(uint32_t n) const {
+            return nodes_[n].parent;
+        }
+
+        bool leaf(uint32_t n) const {
+            return nodes_[n].first_child == none;
+        }
+
+        /*
+        *  Calls f(data) for every subscription that matches the topic name,
+        *  the rules are the same as in trie::match
+        */
+        template<class F>
+        void match(std::string_view topic, F&& f) {
+            match(0, topic, false, true, f);
+        }
+
+        // Position of a walk over the paths that match a topic filter, see match_filter
+        class filter_cursor {
+        public:
+            explicit filter_cursor(std::string_view filter) {
+                for (std::string_view level : levels{ filter }) {
+                    levels_.emplace_back(level);
+                }
+                stack_.push_back(step{ 0, 0, false, false });
+            }
+
+            bool done() const { return stack_.empty(); }
+
+            // Starts the walk again from the root, the node ids of the old walk are no longer held
+            void rewind() {
+                stack_.assign(1, step{ 0, 0, false, false });
+            }
+
+        private:
+            friend class flat_trie;
+
+            struct step {
+                uint32_t node;
+                uint32_t depth;    // levels of the filter matched by the path of the node
+                bool siblings;     // the node and the siblings after it are children matched by a wildcard
+                bool single;       // the wildcard is '+', so the children match one more level
+            };
+
+            std::vector<std::string> levels_;
+            std::vector<step> stack_;
+        };
+
+        /*
+        *  The reverse of match: calls f(data) for the nodes whose paths match the filter,
+        *  with the same rules for wildcards and '$'. At most limit nodes are visited in one call,
+        *  the rest of the walk stays in the cursor, false is returned when nothing is left.
+        *  Node ids in the cursor must not be removed between the calls
+        */
+        template<class F>
+        bool match_filter(filter_cursor& cursor, size_t limit, F&& f) {
+            auto& stack = cursor.stack_;
+            const auto& filter = cursor.levels_;
+
+            while (!stack.empty() && limit > 0) {
+                auto [n, depth, siblings, single] = stack.back();
+                stack.pop_back();
+
+                if (siblings) {
+                    const node& nd = nodes_[n];
+
+                    if (nd.next_sibling != none) {
+                        stack.push_back({ nd.next_sibling, depth, true, single });
+                    }
+
+                    // wildcards on the first level do not match topics starting with '$'
+                    bool dollar = nd.parent == 0 && names_[nd.segment].starts_with('$');
+
+                    if (!dollar && nd.segment != plus_segment && nd.segment != hash_segment) {
+                        stack.push_back({ n, single ? depth + 1 : depth, false, false });
+                    }
+                    continue;
+                }
+
+                if (depth == filter.size()) {
+                    f(data_[n]);
+                    limit--;
+                    continue;
+                }
+
+                const std::string& level = filter[depth];
+
+                if (level == "#") {
+                    // "a/#" also matches "a"
+                    if (n != 0) {
+                        f(data_[n]);
+                        limit--;
+                    }
+                    if (nodes_[n].first_child != none) {
+                        stack.push_back({ nodes_[n].first_child, depth, true, false });
+                    }
+                }
+                else if (level == "+") {
+                    if (nodes_[n].first_child != none) {
+                        stack.push_back({ nodes_[n].first_child, depth, true, true });
+                    }
+                }
+                else if (uint32_t segment = find_segment(level); segment != none && segment != plus_segment && segment != hash_segment) {
+                    if (uint32_t exact = find_edge(n, segment); exact != none) {
+                        stack.push_back({ exact, depth + 1, false, false });
+                    }
+                }
+            }
+            return !stack.empty();
+        }
+
+        // number of nodes including the root
+        size_t size() const {
+            return nodes_.size() - free_nodes_.size();
+        }
+
+        bool empty() const {
+            return size() == 1;
+        }
+
+        /*
+        *  Takes the shape of another trie, so that every node has the same id and path,
+        *  and fills the data with convert(other data, node id).
+        *  The arrays are copied as they are, nothing is hashed again.
+        */
+        template<class U, class F>
+        void assign(const flat_trie<U>& other, F&& convert) {
+            nodes_ = other.nodes_;
+            free_nodes_ = other.free_nodes_;
+            edges_ = other.edges_;
+            edge_count_ = other.edge_count_;
+            names_ = other.names_;
+            refs_ = other.refs_;
+            free_segments_ = other.free_segments_;
+            segment_slots_ = other.segment_slots_;
+
+            data_.clear();
+            data_.reserve(other.data_.size());
+
+            for (uint32_t n = 0; n < other.data_.size(); n++) {
+                data_.push_back(convert(other.data_[n], n));
+            }
+        }
+
+        /*
+        *  Binary image of the trie: the arrays one after another, each with its length.
+        *  save_data(out, data) appends the data of a node, load_data(reader, data) reads it back.
+        *  Numbers are in host byte order.
+        */
+        template<class F>
+        void save(std::vector<uint8_t>& out, F&& save_data) const {
+            put_array(out, nodes_);
+            put_array(out, free_nodes_);
+            put_array(out, edges_);
+            put_array(out, refs_);
+            put_array(out, free_segments_);
+            put_array(out, segment_slots_);
+
+            uint64_t count = names_.size();
+            put(out, &count, sizeof(count));
+
+            for (const std::string& name : names_) {
+                uint32_t len = uint32_t(name.size());
+                put(out, &len, sizeof(len));
+                put(out, name.data(), name.size());
+            }
+
+            for (const T& data : data_) {
+                save_data(out, data);
+            }
+        }
+
+        // Loads an image written by save(), pos is moved past it. False if the image is damaged
+        template<class F>
+        bool load(const uint8_t* image, size_t len, size_t& pos, F&& load_data) {
+            image_reader reader{ image, len, pos };
+
+            bool ok = reader.get_array(nodes_)
+                && reader.get_array(free_nodes_)
+                && reader.get_array(edges_)
+                && reader.get_array(refs_)
+                && reader.get_array(free_segments_)
+                && reader.get_array(segment_slots_);
+
+            uint64_t count = 0;
+            ok = ok && reader.get(&count, sizeof(count)) && count == refs_.size();
+
+            names_.clear();
+            for (uint64_t i = 0; ok && i < count; i++) {
+                uint32_t name_len;
+                ok = reader.get(&name_len, sizeof(name_len)) && reader.left() >= name_len;
+
+                if (ok) {
+                    names_.emplace_back(reinterpret_cast<const char*>(image + reader.pos), name_len);
+                    reader.pos += name_len;
+                }
+            }
+
+            ok = ok && !nodes_.empty() && !edges_.empty() && !segment_slots_.empty()
+                && (edges_.size() & (edges_.size() - 1)) == 0
+                && (segment_slots_.size() & (segment_slots_.size() - 1)) == 0;
+            ok = ok && valid_ids();
+
+            data_.assign(ok ? nodes_.size() : 0, T{});
+            for (size_t n = 0; ok && n < data_.size(); n++) {
+                ok = load_data(reader, data_[n]);
+            }
+
+            edge_count_ = 0;
+            for (const edge& e : edges_) {
+                edge_count_ += e.key != UINT64_MAX;
+            }
+
+            if (!ok) {
+                *this = flat_trie{};
+                return false;
+            }
+
+            pos = reader.pos;
+            return true;
+        }
+
+        // Reads the fields of an image and fails on the first one that does not fit
+        struct image_reader {
+            const uint8_t* image;
+            size_t len;
+            size_t pos;
+
+            size_t left() const { return len - pos; }
+
+            bool get(void* value, size_t size) {
+                if (left() < size) {
+                    return false;
+                }
+                if (size == 0) {
+                    return true;
+                }
+                std::memcpy(value, image + pos, size);
+                pos += size;
+                return true;
+            }
+
+            template<class V>
+            bool get_array(std::vector<V>& values) {
+                uint64_t count;
+
+                if (!get(&count, sizeof(count)) || left() / sizeof(V) < count) {
+                    return false;
+                }
+                values.resize(count);
+                return get(values.data(), count * sizeof(V));
+            }
+        };
+
+    private:
+        // every id of a loaded image points into the arrays, so a damaged image can not be walked out of them
+        bool valid_ids() const {
+            size_t nodes = nodes_.size();
+            size_t segments = names_.size();
+            auto valid_node = [nodes](uint32_t n) { return n == none || n < nodes; };
+            auto valid_segment = [segments](uint32_t id) { return id == none || id < segments; };
+
+            for (const node& nd : nodes_) {
+                if (!valid_node(nd.parent) || !valid_segment(nd.segment) || !valid_node(nd.first_child)
+                    || !valid_node(nd.prev_sibling) || !valid_node(nd.next_sibling)
+                    || !valid_node(nd.plus_child) || !valid_node(nd.hash_child)) {
+                    return false;
+                }
+            }
+
+            for (const edge& e : edges_) {
+                if (e.key != UINT64_MAX && (e.child >= nodes || !valid_segment(uint32_t(e.key)))) {
+                    return false;
+                }
+            }
+
+            for (const segment_slot& slot : segment_slots_) {
+                if (!valid_segment(slot.id)) {
+                    return false;
+                }
+            }
+
+            return std::all_of(free_nodes_.begin(), free_nodes_.end(), [nodes](uint32_t n) { return n < nodes; })
+                && std::all_of(free_segments_.begin(), free_segments_.end(), [segments](uint32_t id) { return id < segments; })
+                && refs_.size() == segments && segments >= 2;
+        }
+
+        static void put(std::vector<uint8_t>& out, const void* data, size_t len) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            out.insert(out.end(), bytes, bytes + len);
+        }
+
+        template<class V>
+        static void put_array(std::vector<uint8_t>& out, const std::vector<V>& values) {
+            static_assert(std::is_trivially_copyable_v<V>);
+
+            uint64_t count = values.size();
+            put(out, &count, sizeof(count));
+            put(out, values.data(), values.size() * sizeof(V));
+        }
+
+        using node = flat_trie_node;
+        using edge = flat_trie_edge;
+        using segment_slot = flat_trie_segment_slot;
+
+        // FNV-1a, the hashes are saved in the image, so they must not depend on the standard library
+        static uint32_t hash_of(std::string_view level) {
+            uint32_t h = 2166136261u;
+            for (char c : level) {
+                h = (h ^ uint8_t(c)) * 16777619u;
+            }
+            return h;
+        }
+
+        static uint64_t key_of(uint32_t parent, uint32_t segment) {
+            return uint64_t(parent) << 32 | segment;
+        }
+
+        static size_t home_of(uint64_t key, size_t mask) {
+            return size_t((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        }
+
+        // is slot k in the cyclic range (i, j]
+        static bool between(size_t i, size_t k, size_t j) {
+            return i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        }
+
+        uint32_t find_segment(std::string_view level) const {
+            uint32_t h = hash_of(level);
+            size_t mask = segment_slots_.size() - 1;
+
+            for (size_t i = h & mask; segment_slots_[i].id != none; i = (i + 1) & mask) {
+                if (segment_slots_[i].hash == h && names_[segment_slots_[i].id] == level) {
+                    return segment_slots_[i].id;
+                }
+            }
+            return none;
+        }
+
+        uint32_t intern(std::string_view level) {
+            uint32_t id = find_segment(level);
+
+            if (id != none) {
+                return id;
+            }
+
+            if ((names_.size() - free_segments_.size() + 1) * 2 > segment_slots_.size()) {
+                rehash_segments(segment_slots_.size() * 2);
+            }
+
+            if (free_segments_.empty()) {
+                id = uint32_t(names_.size());
+                names_.emplace_back(level);
+                refs_.push_back(0);
+            }
+            else {
+                id = free_segments_.back();
+                free_segments_.pop_back();
+                names_[id] = level;
+            }
+
+            put_segment(id, hash_of(level));
+            return id;
+        }
+
+        void put_segment(uint32_t id, uint32_t h) {
+            size_t mask = segment_slots_.size() - 1;
+            size_t i = h & mask;
+
+            while (segment_slots_[i].id != none) {
+                i = (i + 1) & mask;
+            }
+            segment_slots_[i] = segment_slot{ id, h };
+        }
+
+        void rehash_segments(size_t capacity) {
+            std::vector<segment_slot> old = std::move(segment_slots_);
+            segment_slots_.assign(capacity, segment_slot{});
+
+            for (const segment_slot& slot : old) {
+                if (slot.id != none) {
+                    put_segment(slot.id, slot.hash);
+                }
+            }
+        }
+
+        // the segment is forgotten when the last node using it is removed, wildcards are kept forever
+        void release_segment(uint32_t id) {
+            if (--refs_[id] != 0 || id == plus_segment || id == hash_segment) {
+                return;
+            }
+
+            uint32_t h = hash_of(names_[id]);
+            size_t mask = segment_slots_.size() - 1;
+            size_t i = h & mask;
+
+            while (segment_slots_[i].id != id) {
+                i = (i + 1) & mask;
+            }
+
+            // backward shift deletion keeps probe sequences without tombstones
+            for (size_t j = (i + 1) & mask; segment_slots_[j].id != none; j = (j + 1) & mask) {
+                if (!between(i, segment_slots_[j].hash & mask, j)) {
+                    segment_slots_[i] = segment_slots_[j];
+                    i = j;
+                }
+            }
+            segment_slots_[i] = segment_slot{};
+
+            names_[id].clear();
+            names_[id].shrink_to_fit();
+            free_segments_.push_back(id);
+        }
+
+        uint32_t find_edge(uint32_t parent, uint32_t segment) const {
+            if (segment == plus_segment) {
+                return nodes_[parent].plus_child;
+            }
+            if (segment == hash_segment) {
+                return nodes_[parent].hash_child;
+            }
+
+            uint64_t key = key_of(parent, segment);
+            size_t mask = edges_.size() - 1;
+
+            for (size_t i = home_of(key, mask); edges_[i].key != UINT64_MAX; i = (i + 1) & mask) {
+                if (edges_[i].key == key) {
+                    return edges_[i].child;
+                }
+            }
+            return none;
+        }
+
+        void put_edge(uint64_t key, uint32_t child) {
+            size_t mask = edges_.size() - 1;
+            size_t i = home_of(key, mask);
+
+            while (edges_[i].key != UINT64_MAX) {
+                i = (i + 1) & mask;
+            }
+            edges_[i] = edge{ key, child };
+        }
+
+        void erase_edge(uint64_t key) {
+            size_t mask = edges_.size() - 1;
+            size_t i = home_of(key, mask);
+
+            while (edges_[i].key != key) {
+                i = (i + 1) & mask;
+            }
+
+            for (size_t j = (i + 1) & mask; edges_[j].key != UINT64_MAX; j = (j + 1) & mask) {
+                if (!between(i, home_of(edges_[j].key, mask), j)) {
+                    edges_[i] = edges_[j];
+                    i = j;
+                }
+            }
+            edges_[i] = edge{};
+        }
+
+        uint32_t add_node(uint32_t parent, uint32_t segment) {
+            uint32_t n;
+
+            if (free_nodes_.empty()) {
+                n = uint32_t(nodes_.size());
+                nodes_.push_back(node{});
+                data_.emplace_back();
+            }
+            else {
+                n = free_nodes_.back();
+                free_nodes_.pop_back();
+            }
+
+            node& nd = nodes_[n];
+            nd.parent = parent;
+            nd.segment = segment;
+            nd.next_sibling = nodes_[parent].first_child;
+
+            if (nd.next_sibling != none) {
+                nodes_[nd.next_sibling].prev_sibling = n;
+            }
+            nodes_[parent].first_child = n;
+            refs_[segment]++;
+
+            if (segment == plus_segment) {
+                nodes_[parent].plus_child = n;
+            }
+            else if (segment == hash_segment) {
+                nodes_[parent].hash_child = n;
+            }
+            else {
+                if ((edge_count_ + 1) * 2 > edges_.size()) {
+                    rehash_edges(edges_.size() * 2);
+                }
+                put_edge(key_of(parent, segment), n);
+                edge_count_++;
+            }
+            return n;
+        }
+
+        void rehash_edges(size_t capacity) {
+            std::vector<edge> old = std::move(edges_);
+            edges_.assign(capacity, edge{});
+
+            for (const edge& e : old) {
+                if (e.key != UINT64_MAX) {
+                    put_edge(e.key, e.child);
+                }
+            }
+        }
+
+        // detaches the node from the children of its parent
+        void unlink(uint32_t n) {
+            node& nd = nodes_[n];
+            node& parent = nodes_[nd.parent];
+
+            if (nd.prev_sibling != none) {
+                nodes_[nd.prev_sibling].next_sibling = nd.next_sibling;
+            }
+            else {
+                parent.first_child = nd.next_sibling;
+            }
+
+            if (nd.next_sibling != none) {
+                nodes_[nd.next_sibling].prev_sibling = nd.prev_sibling;
+            }
+
+            if (nd.segment == plus_segment) {
+                parent.plus_child = none;
+            }
+            else if (nd.segment == hash_segment) {
+                parent.hash_child = none;
+            }
+            else {
+                erase_edge(key_of(nd.parent, nd.segment));
+                edge_count_--;
+            }
+        }
+
+        // frees the node and all its descendants, the node must be unlinked already
+        void remove_subtree(uint32_t top) {
+            std::vector<uint32_t> stack{ top };
+
+            while (!stack.empty()) {
+                uint32_t n = stack.back();
+                stack.pop_back();
+
+                for (uint32_t c = nodes_[n].first_child; c != none; c = nodes_[c].next_sibling) {
+                    if (nodes_[c].segment != plus_segment && nodes_[c].segment != hash_segment) {
+                        erase_edge(key_of(n, nodes_[c].segment));
+                        edge_count_--;
+                    }
+                    stack.push_back(c);
+                }
+
+                release_segment(nodes_[n].segment);
+                nodes_[n] = node{};
+                data_[n] = T{};
+                free_nodes_.push_back(n);
+            }
+        }
+
+        template<class F>
+        void match(uint32_t n, std::string_view rest, bool done, bool first, F& f) {
+
+            if (done) {
+                f(data_[n]);
+
+                // "a/#" also matches "a"
+                if (uint32_t multi = nodes_[n].hash_child; multi != none) {
+                    f(data_[multi]);
+                }
+                return;
+            }
+
+            size_t pos = rest.find('/');
+            std::string_view level = rest.substr(0, pos);
+            std::string_view next = pos == std::string_view::npos ? std::string_view{} : rest.substr(pos + 1);
+            bool next_done = pos == std::string_view::npos;
+
+            if (!(first && !level.empty() && level[0] == '$')) {
+                if (uint32_t multi = nodes_[n].hash_child; multi != none) {
+                    f(data_[multi]);
+                }
+
+                if (uint32_t single = nodes_[n].plus_child; single != none) {
+                    match(single, next, next_done, false, f);
+                }
+            }
+
+            // topic names never contain wildcards, only real segments have edges
+            uint32_t segment = find_segment(level);
+
+            if (segment != none && segment != plus_segment && segment != hash_segment) {
+                if (uint32_t exact = find_edge(n, segment); exact != none) {
+                    match(exact, next, next_done, false, f);
+                }
+            }
+        }
+
+        std::vector<node> nodes_;
+        std::vector<T> data_;
+        std::vector<uint32_t> free_nodes_;
+
+        std::vector<edge> edges_;
+        size_t edge_count_ = 0;
+
+        std::vector<std::string> names_;
+        std::vector<uint32_t> refs_;
+        std::vector<uint32_t> free_segments_;
+        std::vector<segment_slot> segment_slots_;
+    };
+}
+
+#endif // !MQTT_CONTAINERS_FLAT_TRIE_H_
@@ -0,0 +1,51 @@
+#include "frame_decoder.hpp"
+
+#include "mqtt.hpp"
+
+mqtt::FrameDecoder::kStatus mqtt::FrameDecoder::Parse(const uint8_t* data, size_t size) {
+
+	if (state_ == kType) {
+		if (size < 1) {
+			return kNeedMore;
+		}
+		state_ = kLength;
+	}
+
+	if (state_ == kLength) {
+		size_t len_bytes = 0;
+		long long len = mqtt::DecodeLength(data + 1, size - 1, &len_bytes);
+
+		if (len == LENGTH_INCOMPLETE) {
+			return kNeedMore;
+		}
+
+		if (len < 0) {
+			return kMalformed;
+		}
+
+		header_len_ = 1 + len_bytes;
+		remaining_length_ = uint32_t(len);
+		state_ = kBody;
+	}
+
+	if (size < FrameSize()) {
+		return kNeedMore;
+	}
+
+	return kFrame;
+}
+
+void mqtt::FrameDecoder::Reset() {
+	state_ = kType;
+	header_len_ = 1;
+	remaining_length_ = 0;
+}
+
+size_t mqtt::FrameDecoder::Needed() const {
+	if (state_ == kBody) {
+		return FrameSize();
+	}
+
+	// the length is not known yet, the largest fixed header is enough to learn it
+	return 1 + MAX_LENGTH_BYTES;
+}
@@ -0,0 +1,50 @@
+#ifndef MQTT_UTILITY_FRAME_DECODER_H_
+#define MQTT_UTILITY_FRAME_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mqtt {
+
+	/*
+	*  Incremental decoder of MQTT frames in a byte stream.
+	*  The decoder is fed with all bytes buffered after the start of the current frame,
+	*  once the fixed header is decoded it only waits for the body,
+	*  no matter how many reads it takes to receive the frame.
+	*/
+	class FrameDecoder {
+	public:
+		enum kStatus {
+			kFrame = 0,   // a complete frame is at the beginning of the data
+			kNeedMore,    // the frame is not fully received yet
+			kMalformed    // the Remaining Length is longer than 4 bytes
+		};
+
+		kStatus Parse(const uint8_t* data, size_t size);
+
+		// Prepares the decoder for the next frame
+		void Reset();
+
+		// Valid after kFrame: fixed header plus Remaining Length
+		size_t FrameSize() const { return header_len_ + remaining_length_; }
+		size_t HeaderSize() const { return header_len_; }
+		uint32_t RemainingLength() const { return remaining_length_; }
+
+		// Number of bytes the current frame needs, as far as it is known
+		size_t Needed() const;
+
+	private:
+		enum kState {
+			kType = 0,
+			kLength,
+			kBody
+		};
+
+		kState state_ = kType;
+		size_t header_len_ = 1;
+		uint32_t remaining_length_ = 0;
+	};
+
+} // namespace mqtt
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef MQTT_UTILITY_HISTOGRAM_H_
+#define MQTT_UTILITY_HISTOGRAM_H_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace stats {
+
+	/*
+	*  Histogram in the layout of HdrHistogram: every power of two is split into 2^SubBits
+	*  linear buckets, so any value up to 2^64 is kept with a relative error below 2^-SubBits
+	*  in a fixed array. Recording is an index computation and an increment, every thread records
+	*  into its own histogram and they are merged when they are read.
+	*  Index, Value and PercentileOf serve histograms that keep the counts in arrays of their own
+	*/
+	template<int SubBits>
+	class Histogram {
+	public:
+		static constexpr int kSubBits = SubBits;
+		static constexpr size_t kSubBuckets = size_t(1) << kSubBits;
+		static constexpr size_t kBuckets = size_t(64 - kSubBits + 1) << kSubBits;
+
+		static size_t Index(uint64_t value) {
+			if (value < kSubBuckets) {
+				return size_t(value);
+			}
+
+			int shift = 63 - std::countl_zero(value) - kSubBits;
+			return (size_t(shift + 1) << kSubBits) + size_t((value >> shift) - kSubBuckets);
+		}
+
+		// middle of the bucket
+		static uint64_t Value(size_t index) {
+			size_t block = index >> kSubBits;
+			uint64_t sub = index & (kSubBuckets - 1);
+
+			if (block == 0) {
+				return sub;
+			}
+
+			int shift = int(block) - 1;
+			return ((sub + kSubBuckets) << shift) + ((uint64_t(1) << shift) >> 1u);
+		}
+
+		// Value below which the fraction p of count values lie, p is in [0, 1], counts[i] is the count of bucket i
+		template<class Counts>
+		static uint64_t PercentileOf(const Counts& counts, uint64_t count, double p, uint64_t min, uint64_t max) {
+			if (count == 0) {
+				return 0;
+			}
+
+			uint64_t rank = std::max<uint64_t>(1, uint64_t(p * count + 0.5));
+			uint64_t seen = 0;
+
+			for (size_t i = 0; i < kBuckets; i++) {
+				seen += counts[i];
+				if (seen >= rank) {
+					return std::clamp(Value(i), min, max);
+				}
+			}
+			return max;
+		}
+
+		void Record(uint64_t value) {
+			counts_[Index(value)]++;
+			count_++;
+			sum_ += value;
+			min_ = std::min(min_, value);
+			max_ = std::max(max_, value);
+		}
+
+		void Merge(const Histogram& other) {
+			for (size_t i = 0; i < counts_.size(); i++) {
+				counts_[i] += other.counts_[i];
+			}
+			count_ += other.count_;
+			sum_ += other.sum_;
+			min_ = std::min(min_, other.min_);
+			max_ = std::max(max_, other.max_);
+		}
+
+		uint64_t Percentile(double p) const { return PercentileOf(counts_, count_, p, min_, max_); }
+
+		uint64_t Count() const { return count_; }
+		uint64_t Min() const { return count_ == 0 ? 0 : min_; }
+		uint64_t Max() const { return max_; }
+		double Mean() const { return count_ == 0 ? 0 : double(sum_) / count_; }
+
+	private:
+		std::array<uint64_t, kBuckets> counts_{};
+		uint64_t count_ = 0;
+		uint64_t sum_ = 0;
+		uint64_t min_ = std::numeric_limits<uint64_t>::max();
+		uint64_t max_ = 0;
+	};
+
+} // namespace stats
+
+#endif
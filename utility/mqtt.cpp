@@ -1,338 +1,618 @@
-#include "mqtt.hpp"
-
-
-
-int mqtt::EncodeLength(uint8_t* buffer, size_t len) {
-	int bytes = 0;
-	int d;
-	buffer[1] = 0x00;
-
-	do {
-		d = len % 128;
-		len /= 128;
-		if (len > 0)
-			d |= 128;
-		buffer[bytes++] = d;
-
-	} while (len > 0);
-	return bytes;
-}
-
-long long mqtt::DecodeLength(const uint8_t* buffer) {
-	char byte = 0;
-	int multiplier = 1;
-	unsigned long long value = 0;
-
-	do
-	{
-		byte = *buffer;
-		value += (byte & 127) * multiplier;
-		multiplier *= 128;
-		buffer++;
-	} while ((byte & 128) != 0);
-	return value;
-}
-
-size_t mqtt::UnpackConnect(const uint8_t* buffer, mqtt::Header* head, mqtt::Connect* pkt) {
-
-	pkt->header = *head;
-
-	size_t size = mqtt::DecodeLength(buffer);
-
-	buffer += 8;
-
-	pkt->variable_header.level = *buffer;
-
-	buffer++;
-
-	pkt->variable_header.connect_flags = *buffer;
-
-	buffer++;
-
-	pkt->variable_header.keepalive = (*buffer << 8u) | (*(buffer + 1));
-
-	buffer += 2;
-
-	uint16_t len;
-	len = (*buffer << 8u) | (*(buffer + 1));
-	buffer += 2;
-
-	if (len > 0) {
-		pkt->payload.cliend_id = std::string((char*)buffer, len);
-	}
-	buffer += len;
-	if ((pkt->variable_header.connect_flags & 0x4)) {
-		len = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		pkt->payload.will_topic = std::string((char*)buffer, len);
-		buffer += len;
-		len = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		pkt->payload.will_message = std::string((char*)buffer, len);
-		buffer += len;
-	}
-
-	if ((pkt->variable_header.connect_flags & 0x80)) {
-		len = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		pkt->payload.username = std::string((char*)buffer, len);
-		buffer += len;
-	}
-
-	if ((pkt->variable_header.connect_flags & 0x40)) {
-		len = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		pkt->payload.password = std::string((char*)buffer, len);
-		buffer += len - 1;
-	}
-
-	return size;
-}
-
-size_t mqtt::UnpackPublish(const uint8_t* buffer, Header* head, Publish* pkt)
-{
-	mqtt::Publish* pub = pkt;
-
-	pub->header = *head;
-
-	size_t len = mqtt::DecodeLength(buffer + 1);
-	buffer += 2;
-
-	uint16_t topic_len = (*buffer << 8u) | (*(buffer + 1));
-	
-	buffer += 2;
-
-	pub->topic = std::string((char*)buffer, topic_len);
-	buffer += topic_len;
-
-	if (((pub->header.bits & 0x6) >> 1u) > 0) {
-		
-		pub->pkt_id = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		topic_len += 2;
-	}
-	
-	pkt->payload = std::string((char*)buffer, len - topic_len - 2);
-
-	return len;
-}
-
-long long mqtt::UnpackSubscribe(const uint8_t* buffer, Header* head, Subscribe* pkt)
-{
-	
-	long long len = mqtt::DecodeLength(buffer + 1);
-	size_t remaining_len = len;
-
-	Subscribe* sub = pkt;
-	sub->header = *head;
-
-	buffer += 2;
-
-	sub->pkt_id = (*buffer << 8u) | (*(buffer + 1));
-	buffer += 2;
-	remaining_len -= sizeof(uint16_t);
-
-	while(remaining_len > 0) { //can work alg op with remaining_len ?
-		remaining_len -= sizeof(uint16_t);
-		uint16_t topic_len = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		sub->topic_and_qos.insert(
-			std::make_pair(std::string((char*)buffer, topic_len), *(buffer + topic_len)));
-
-		if((*(buffer + topic_len) & 0xFC) != 0) {
-			return -1;
-		}
-
-		buffer += topic_len + 1;
-		remaining_len -= (topic_len + sizeof(uint8_t));
-	}
-	
-	return len;
-}
-
-size_t mqtt::UnpackUnsubscribe(const uint8_t* buffer, Header* head, Unsubscribe* pkt) {
-	size_t len = DecodeLength(buffer + 1);
-	size_t remaining_bytes = len;
-	Unsubscribe* unsub = pkt;
-	unsub->header = *head;
-
-	buffer += 2;
-
-	unsub->pkt_id = (*buffer << 8u) | (*(buffer + 1));
-	buffer += 2;
-	remaining_bytes -= sizeof(uint16_t);
-
-	while(remaining_bytes > 0) {
-		uint16_t topic_len = (*buffer << 8u) | (*(buffer + 1));
-		buffer += 2;
-		unsub->topics.push_back(std::string((char*)buffer, topic_len));
-		buffer += topic_len;
-		remaining_bytes -= topic_len;
-		remaining_bytes -= 2;
-	}
-
-	return len;
-}
-
-size_t mqtt::UnpackAck(const uint8_t* buffer, Header* head, AckPacket* pkt) {
-	size_t len = DecodeLength(buffer + 1);
-	AckPacket* paket = pkt;
-
-	paket->header = *head;
-
-	buffer += 2;
-
-	paket->pkt_id = (*buffer << 8u) | (*(buffer + 1));
-	buffer += 2;
-
-	return len;
-}
-
-mqtt::AckPacket mqtt::PacketAck(const uint8_t byte, const uint16_t pkt_id) {
-	AckPacket ack;
-	ack.header.bits = byte;
-	ack.header.remaining_length = 0x02;
-	ack.pkt_id = pkt_id;
-
-	return ack;
-}
-
-mqtt::Connack mqtt::PacketConnack
-	(const uint8_t byte, const uint8_t flags, const uint8_t rc) {
-
-	Connack conk;
-	conk.header.bits = byte;
-	conk.header.remaining_length = 0x02;
-	conk.flags = flags;
-	conk.rc = rc;
-	return conk;
-}
-
-mqtt::Suback mqtt::PacketSuback
-	(const uint8_t byte, const uint16_t pkt_id, const uint16_t rc_len, const uint8_t* rcs) {
-	mqtt::Suback sub;
-	sub.header.bits = byte;
-	sub.pkt_id = pkt_id;
-	sub.rcs.reserve(rc_len);
-	std::copy(rcs, rcs + rc_len, std::back_inserter(sub.rcs));
-	return sub;
-}
-
-mqtt::Publish mqtt::PacketPublish
-	(const uint8_t byte, const uint16_t pkt_id, const std::string topic, const std::string payload) {
-
-	Publish pub;
-	pub.header.bits = byte;
-	pub.pkt_id = pkt_id;
-	pub.topic = topic;
-	pub.payload = payload;
-
-	return pub;
-}
-
-
-uint8_ptr mqtt::PackHeader(mqtt::Header* hdr) {
-
-	uint8_ptr ptr{ new uint8_t[2] };
-	ptr.get()[0] = hdr->bits;
-	ptr.get()[1] = 0x00;
-
-	return ptr;
-}
-
-uint8_ptr mqtt::PackAck(mqtt::AckPacket* ack) {
-	uint8_ptr ptr{ new uint8_t[4] };
-	auto pack = ptr.get();
-
-	pack[0] = ack->header.bits;
-	pack[1] = 0x02;
-	pack[2] = uint8_t(ack->pkt_id >> 8u);
-	pack[3] = uint8_t(ack->pkt_id);
-
-	return ptr;
-}
-
-uint8_ptr mqtt::PackConnack(mqtt::Connack* con) {
-	uint8_ptr ptr{ new uint8_t[4] };
-	ptr.get()[0] = con->header.bits;
-	ptr.get()[1] = 0x02;
-	ptr.get()[2] = con->flags;
-	ptr.get()[3] = con->rc;
-
-	return ptr;
-}
-
-uint8_ptr mqtt::PackSuback(mqtt::Suback* sub) {
-	uint8_ptr ptr{ new uint8_t[2 + sizeof(uint16_t) + sub->rcs.size()] };
-	ptr.get()[0] = sub->header.bits;
-	mqtt::EncodeLength(ptr.get() + 1, sizeof(uint16_t) + sub->rcs.size());
-	ptr.get()[2] = uint8_t(sub->pkt_id >> 8u);
-	ptr.get()[3] = uint8_t(sub->pkt_id);
-	
-	for(int i = 0; i < sub->rcs.size(); i++) {
-		ptr.get()[4 + i] = sub->rcs[i];
-	}
-	return ptr;
-}
-
-uint8_ptr mqtt::PackPublish(mqtt::Publish* pub) {
-	size_t packet_len = 2; // bits and remaining length
-	packet_len += sizeof(uint16_t); // Length MSB and Length LSB
-	packet_len += pub->topic.size(); // topic len
-	packet_len += pub->payload.size(); // payload len
-
-	if (((pub->header.bits & 0x6) >> 1u) > 0) {
-		packet_len += 2;
-	}
-
-
-	uint8_ptr ptr{ new uint8_t[packet_len] };
-	auto pack = ptr.get();
-
-	pack[0] = pub->header.bits;
-	packet_len -= 2;
-	mqtt::EncodeLength(pack + 1, packet_len);
-	pack[2] = uint8_t(pub->topic.size() >> 8u); // MSB
-	pack[3] = uint8_t(pub->topic.size()); // LSB
-
-	size_t pos = 4;
-
-	size_t end = 4;
-	end += pub->topic.size();
-
-	for (; pos < end; ++pos) {
-		pack[pos] = pub->topic[pos - 4];
-	}
-
-	pos = end;
-
-	if (((pub->header.bits & 0x6) >> 1u) > 0) {
-		end++;
-
-		if(pub->pkt_id != 0) {
-			pack[pos] = uint8_t(pub->pkt_id >> 8u);
-			pack[end] = uint8_t(pub->pkt_id);
-		} else {
-			pack[pos] = 0;
-			pack[end] = 1;
-		}
-		pos += 2;
-	}
-
-
-
-	for (auto& w : pub->payload) {
-		pack[pos] = w;
-		pos++;
-	}
-
-	return ptr;
-}
-
-uint8_ptr mqtt::PackPingreq(mqtt::Pingreq* ping) {
-	return PackHeader(ping);
-}
-
-uint8_ptr mqtt::PackPingresp(mqtt::Pingresp* ping) {
-	return PackHeader(ping);
-}
\ No newline at end of file
+#include "mqtt.hpp"
+
+
+
+int mqtt::EncodeLength(uint8_t* buffer, size_t len) {
+	int bytes = 0;
+	int d;
+	buffer[1] = 0x00;
+
+	do {
+		d = len % 128;
+		len /= 128;
+		if (len > 0)
+			d |= 128;
+		buffer[bytes++] = d;
+
+	} while (len > 0);
+	return bytes;
+}
+
+long long mqtt::DecodeLength(const uint8_t* buffer) {
+	size_t len_bytes = 0;
+	long long len = DecodeLength(buffer, MAX_LENGTH_BYTES, &len_bytes);
+
+	return len == LENGTH_INCOMPLETE ? LENGTH_MALFORMED : len;
+}
+
+long long mqtt::DecodeLength(const uint8_t* buffer, size_t size, size_t* len_bytes) {
+	long long value = 0;
+	int multiplier = 1;
+
+	for (size_t i = 0; i < MAX_LENGTH_BYTES; i++) {
+		if (i == size) {
+			return LENGTH_INCOMPLETE;
+		}
+
+		value += (buffer[i] & 127) * multiplier;
+		multiplier *= 128;
+
+		if ((buffer[i] & 128) == 0) {
+			*len_bytes = i + 1;
+			return value;
+		}
+	}
+
+	return LENGTH_MALFORMED;
+}
+
+namespace {
+
+	/*
+	*  Reads the fields of a packet up to the end of its frame.
+	*  A read past the end returns zeros and moves the reader to the end, so a packet is checked
+	*  with one branch per field that is never taken for valid packets and one Failed() at the end
+	*/
+	class FieldReader {
+	public:
+		FieldReader(const uint8_t* pos, const uint8_t* end) : pos_(pos), end_(end) {}
+
+		uint8_t Byte() {
+			if (pos_ == end_) [[unlikely]] {
+				failed_ = true;
+				return 0;
+			}
+			return *pos_++;
+		}
+
+		uint16_t Short() {
+			if (Left() < sizeof(uint16_t)) [[unlikely]] {
+				Fail();
+				return 0;
+			}
+			uint16_t value = uint16_t((pos_[0] << 8u) | pos_[1]);
+			pos_ += sizeof(uint16_t);
+			return value;
+		}
+
+		// UTF-8 string with a two byte length
+		std::string_view String() {
+			size_t len = Short();
+
+			if (Left() < len) [[unlikely]] {
+				Fail();
+				return {};
+			}
+			std::string_view str{ (const char*)pos_, len };
+			pos_ += len;
+			return str;
+		}
+
+		// everything that is left in the frame
+		std::string_view Rest() {
+			std::string_view rest{ (const char*)pos_, Left() };
+			pos_ = end_;
+			return rest;
+		}
+
+		size_t Left() const { return size_t(end_ - pos_); }
+		bool Failed() const { return failed_; }
+
+	private:
+		void Fail() {
+			failed_ = true;
+			pos_ = end_;
+		}
+
+		const uint8_t* pos_;
+		const uint8_t* end_;
+		bool failed_ = false;
+	};
+
+	// Required flags of the fixed header and the bounds of the Remaining Length for every packet type
+	struct TypeRule {
+		uint8_t flags;
+		uint8_t mask;
+		uint32_t min_len;
+		uint32_t max_len;
+	};
+
+	constexpr uint32_t kAnyLength = 268435455;
+
+	// reserved types 0 and 15 require bits that can not be in the low half of a byte
+	constexpr TypeRule kTypeRules[16] = {
+		{ 0x10, 0x0F, 0, 0 },          // reserved
+		{ 0x00, 0x0F, 10, kAnyLength }, // CONNECT
+		{ 0x00, 0x0F, 2, 2 },          // CONNACK
+		{ 0x00, 0x00, 2, kAnyLength },  // PUBLISH, QoS is checked by UnpackPublish
+		{ 0x00, 0x0F, 2, 2 },          // PUBACK
+		{ 0x00, 0x0F, 2, 2 },          // PUBREC
+		{ 0x02, 0x0F, 2, 2 },          // PUBREL
+		{ 0x00, 0x0F, 2, 2 },          // PUBCOMP
+		{ 0x02, 0x0F, 2, kAnyLength },  // SUBSCRIBE
+		{ 0x00, 0x0F, 3, kAnyLength },  // SUBACK
+		{ 0x02, 0x0F, 2, kAnyLength },  // UNSUBSCRIBE
+		{ 0x00, 0x0F, 2, 2 },          // UNSUBACK
+		{ 0x00, 0x0F, 0, 0 },          // PINGREQ
+		{ 0x00, 0x0F, 0, 0 },          // PINGRESP
+		{ 0x00, 0x0F, 0, 0 },          // DISCONNECT
+		{ 0x10, 0x0F, 0, 0 }           // reserved
+	};
+
+	// Checks the fixed header and sets the reader to the rest of the frame.
+	// It is inlined, so the reader stays in the registers of the Unpack function
+	inline mqtt::kDecodeStatus BeginFrame(const uint8_t* frame, size_t size, mqtt::Header* head, FieldReader* reader) {
+		if (size < 2) {
+			return mqtt::kTruncated;
+		}
+
+		size_t len_bytes = 1;
+		long long len = frame[1];
+
+		// most packets are shorter than 128 bytes and have a one byte length
+		if ((frame[1] & 0x80) != 0) {
+			len = mqtt::DecodeLength(frame + 1, size - 1, &len_bytes);
+
+			if (len == LENGTH_INCOMPLETE) {
+				return mqtt::kTruncated;
+			}
+			if (len == LENGTH_MALFORMED) {
+				return mqtt::kBadLength;
+			}
+		}
+
+		head->bits = frame[0];
+		head->remaining_length = uint32_t(len);
+
+		const TypeRule& rule = kTypeRules[frame[0] >> 4u];
+
+		if ((frame[0] & rule.mask) != rule.flags) {
+			return mqtt::kBadFlags;
+		}
+		if (head->remaining_length < rule.min_len || head->remaining_length > rule.max_len) {
+			return mqtt::kBadLength;
+		}
+		if (size - 1 - len_bytes < head->remaining_length) {
+			return mqtt::kTruncated;
+		}
+
+		const uint8_t* body = frame + 1 + len_bytes;
+		*reader = FieldReader{ body, body + head->remaining_length };
+
+		return mqtt::kDecoded;
+	}
+}
+
+const char* mqtt::DecodeStatusString(kDecodeStatus status) {
+	switch (status) {
+	case kDecoded:     return "valid packet";
+	case kTruncated:   return "a field runs past the end of the packet";
+	case kBadLength:   return "the remaining length does not fit the packet";
+	case kBadFlags:    return "the value of the reserved bit is incorrect";
+	case kBadProtocol: return "unknown protocol name";
+	case kBadQos:      return "QoS 3 is not allowed";
+	case kNoTopics:    return "the packet has no topics";
+	case kBadTopic:    return "the topic name is empty or has wildcards";
+	}
+	return "unknown error";
+}
+
+mqtt::kDecodeStatus mqtt::UnpackHeader(const uint8_t* frame, size_t size, Header* head) {
+	FieldReader reader{ frame, frame };
+
+	return BeginFrame(frame, size, head, &reader);
+}
+
+mqtt::kDecodeStatus mqtt::UnpackConnect(const uint8_t* frame, size_t size, Connect* pkt) {
+	FieldReader reader{ frame, frame };
+
+	if (kDecodeStatus status = BeginFrame(frame, size, &pkt->header, &reader); status != kDecoded) {
+		return status;
+	}
+
+	std::string_view protocol = reader.String();
+	pkt->variable_header.level = reader.Byte();
+	pkt->variable_header.connect_flags = reader.Byte();
+	pkt->variable_header.keepalive = reader.Short();
+
+	if (reader.Failed()) {
+		return kTruncated;
+	}
+
+	// "MQIsdp" is the name of MQTT 3.1
+	if (protocol != "MQTT" && protocol != "MQIsdp") {
+		return kBadProtocol;
+	}
+
+	uint8_t flags = pkt->variable_header.connect_flags;
+	bool will = (flags & 0x04) != 0;
+
+	// the reserved bit, QoS 3 of the will, will QoS or retain without a will, password without a username
+	if ((flags & 0x01) != 0 || (flags & 0x18) == 0x18 || (!will && (flags & 0x38) != 0)
+		|| (flags & 0xC0) == 0x40) {
+		return kBadFlags;
+	}
+
+	pkt->payload.cliend_id = reader.String();
+
+	if (will) {
+		pkt->payload.will_topic = reader.String();
+		pkt->payload.will_message = reader.String();
+	}
+
+	if ((flags & 0x80) != 0) {
+		pkt->payload.username = reader.String();
+	}
+
+	if ((flags & 0x40) != 0) {
+		pkt->payload.password = reader.String();
+	}
+
+	if (reader.Failed()) {
+		return kTruncated;
+	}
+
+	// the will is published to its topic like a PUBLISH of the client
+	if (will && !ValidTopicName(pkt->payload.will_topic)) {
+		return kBadTopic;
+	}
+
+	return reader.Left() == 0 ? kDecoded : kBadLength;
+}
+
+mqtt::kDecodeStatus mqtt::UnpackPublish(const uint8_t* frame, size_t size, Publish* pkt)
+{
+	mqtt::PublishView view;
+	kDecodeStatus status = mqtt::UnpackPublish(frame, size, &view);
+
+	if (status != kDecoded) {
+		return status;
+	}
+
+	pkt->header = view.header;
+	pkt->topic = std::string(view.topic);
+	pkt->pkt_id = view.pkt_id;
+	pkt->payload = std::string(view.payload);
+
+	return kDecoded;
+}
+
+mqtt::kDecodeStatus mqtt::UnpackPublish(const uint8_t* frame, size_t size, PublishView* pkt)
+{
+	FieldReader reader{ frame, frame };
+
+	if (kDecodeStatus status = BeginFrame(frame, size, &pkt->header, &reader); status != kDecoded) {
+		return status;
+	}
+
+	uint8_t qos = (pkt->header.bits & 0x6) >> 1u;
+
+	if (qos == 3) {
+		return kBadQos;
+	}
+
+	pkt->topic = reader.String();
+
+	if (qos > 0) {
+		pkt->pkt_id = reader.Short();
+	}
+
+	if (reader.Failed()) {
+		return kTruncated;
+	}
+
+	// a topic name with wildcards would be matched by the subscription tree as a filter
+	if (!ValidTopicName(pkt->topic)) {
+		return kBadTopic;
+	}
+
+	pkt->payload = reader.Rest();
+
+	return kDecoded;
+}
+
+mqtt::kDecodeStatus mqtt::UnpackSubscribe(const uint8_t* frame, size_t size, Subscribe* pkt)
+{
+	FieldReader reader{ frame, frame };
+
+	if (kDecodeStatus status = BeginFrame(frame, size, &pkt->header, &reader); status != kDecoded) {
+		return status;
+	}
+
+	pkt->pkt_id = reader.Short();
+
+	while (reader.Left() > 0) {
+		std::string_view topic = reader.String();
+		uint8_t qos = reader.Byte();
+
+		if (reader.Failed()) {
+			return kTruncated;
+		}
+
+		// the upper six bits are reserved
+		if (qos > 2) {
+			return kBadQos;
+		}
+
+		pkt->topic_and_qos.emplace_back(std::string(topic), qos);
+	}
+
+	return pkt->topic_and_qos.empty() ? kNoTopics : kDecoded;
+}
+
+mqtt::kDecodeStatus mqtt::UnpackUnsubscribe(const uint8_t* frame, size_t size, Unsubscribe* pkt) {
+	FieldReader reader{ frame, frame };
+
+	if (kDecodeStatus status = BeginFrame(frame, size, &pkt->header, &reader); status != kDecoded) {
+		return status;
+	}
+
+	pkt->pkt_id = reader.Short();
+
+	while (reader.Left() > 0) {
+		std::string_view topic = reader.String();
+
+		if (reader.Failed()) {
+			return kTruncated;
+		}
+
+		pkt->topics.emplace_back(topic);
+	}
+
+	return pkt->topics.empty() ? kNoTopics : kDecoded;
+}
+
+mqtt::kDecodeStatus mqtt::UnpackAck(const uint8_t* frame, size_t size, AckPacket* pkt) {
+	FieldReader reader{ frame, frame };
+
+	if (kDecodeStatus status = BeginFrame(frame, size, &pkt->header, &reader); status != kDecoded) {
+		return status;
+	}
+
+	// the fixed header has checked the Remaining Length of the acks the server receives
+	pkt->pkt_id = reader.Short();
+
+	return reader.Failed() ? kTruncated : kDecoded;
+}
+
+mqtt::AckPacket mqtt::PacketAck(const uint8_t byte, const uint16_t pkt_id) {
+	AckPacket ack;
+	ack.header.bits = byte;
+	ack.header.remaining_length = 0x02;
+	ack.pkt_id = pkt_id;
+
+	return ack;
+}
+
+mqtt::Connack mqtt::PacketConnack
+	(const uint8_t byte, const uint8_t flags, const uint8_t rc) {
+
+	Connack conk;
+	conk.header.bits = byte;
+	conk.header.remaining_length = 0x02;
+	conk.flags = flags;
+	conk.rc = rc;
+	return conk;
+}
+
+mqtt::Suback mqtt::PacketSuback
+	(const uint8_t byte, const uint16_t pkt_id, const uint16_t rc_len, const uint8_t* rcs) {
+	mqtt::Suback sub;
+	sub.header.bits = byte;
+	sub.pkt_id = pkt_id;
+	sub.rcs.reserve(rc_len);
+	std::copy(rcs, rcs + rc_len, std::back_inserter(sub.rcs));
+	return sub;
+}
+
+mqtt::Publish mqtt::PacketPublish
+	(const uint8_t byte, const uint16_t pkt_id, const std::string topic, const std::string payload) {
+
+	Publish pub;
+	pub.header.bits = byte;
+	pub.pkt_id = pkt_id;
+	pub.topic = topic;
+	pub.payload = payload;
+
+	return pub;
+}
+
+
+uint8_ptr mqtt::PackHeader(mqtt::Header* hdr) {
+
+	uint8_ptr ptr{ new uint8_t[2] };
+	ptr.get()[0] = hdr->bits;
+	ptr.get()[1] = 0x00;
+
+	return ptr;
+}
+
+uint8_ptr mqtt::PackAck(mqtt::AckPacket* ack) {
+	uint8_ptr ptr{ new uint8_t[4] };
+	auto pack = ptr.get();
+
+	pack[0] = ack->header.bits;
+	pack[1] = 0x02;
+	pack[2] = uint8_t(ack->pkt_id >> 8u);
+	pack[3] = uint8_t(ack->pkt_id);
+
+	return ptr;
+}
+
+uint8_ptr mqtt::PackConnack(mqtt::Connack* con) {
+	uint8_ptr ptr{ new uint8_t[4] };
+	ptr.get()[0] = con->header.bits;
+	ptr.get()[1] = 0x02;
+	ptr.get()[2] = con->flags;
+	ptr.get()[3] = con->rc;
+
+	return ptr;
+}
+
+uint8_ptr mqtt::PackSuback(mqtt::Suback* sub) {
+	uint8_ptr ptr{ new uint8_t[2 + sizeof(uint16_t) + sub->rcs.size()] };
+	ptr.get()[0] = sub->header.bits;
+	mqtt::EncodeLength(ptr.get() + 1, sizeof(uint16_t) + sub->rcs.size());
+	ptr.get()[2] = uint8_t(sub->pkt_id >> 8u);
+	ptr.get()[3] = uint8_t(sub->pkt_id);
+	
+	for(int i = 0; i < sub->rcs.size(); i++) {
+		ptr.get()[4 + i] = sub->rcs[i];
+	}
+	return ptr;
+}
+
+uint8_ptr mqtt::PackPublish(mqtt::Publish* pub) {
+	size_t packet_len = 2; // bits and remaining length
+	packet_len += sizeof(uint16_t); // Length MSB and Length LSB
+	packet_len += pub->topic.size(); // topic len
+	packet_len += pub->payload.size(); // payload len
+
+	if (((pub->header.bits & 0x6) >> 1u) > 0) {
+		packet_len += 2;
+	}
+
+
+	uint8_ptr ptr{ new uint8_t[packet_len] };
+	auto pack = ptr.get();
+
+	pack[0] = pub->header.bits;
+	packet_len -= 2;
+	mqtt::EncodeLength(pack + 1, packet_len);
+	pack[2] = uint8_t(pub->topic.size() >> 8u); // MSB
+	pack[3] = uint8_t(pub->topic.size()); // LSB
+
+	size_t pos = 4;
+
+	size_t end = 4;
+	end += pub->topic.size();
+
+	for (; pos < end; ++pos) {
+		pack[pos] = pub->topic[pos - 4];
+	}
+
+	pos = end;
+
+	if (((pub->header.bits & 0x6) >> 1u) > 0) {
+		end++;
+
+		if(pub->pkt_id != 0) {
+			pack[pos] = uint8_t(pub->pkt_id >> 8u);
+			pack[end] = uint8_t(pub->pkt_id);
+		} else {
+			pack[pos] = 0;
+			pack[end] = 1;
+		}
+		pos += 2;
+	}
+
+
+
+	for (auto& w : pub->payload) {
+		pack[pos] = w;
+		pos++;
+	}
+
+	return ptr;
+}
+
+uint8_ptr mqtt::PackPingreq(mqtt::Pingreq* ping) {
+	return PackHeader(ping);
+}
+
+uint8_ptr mqtt::PackPingresp(mqtt::Pingresp* ping) {
+	return PackHeader(ping);
+}
+
+bool mqtt::ValidTopicFilter(std::string_view filter) {
+	if (filter.empty()) {
+		return false;
+	}
+
+	for (size_t i = 0; i < filter.size(); i++) {
+		bool level_start = i == 0 || filter[i - 1] == '/';
+		bool level_end = i + 1 == filter.size() || filter[i + 1] == '/';
+
+		if (filter[i] == '+' && !(level_start && level_end)) {
+			return false;
+		}
+
+		if (filter[i] == '#' && !(level_start && i + 1 == filter.size())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Runs for every PUBLISH, so it is one pass without a branch per byte that the compiler can vectorize
+bool mqtt::ValidTopicName(std::string_view topic) {
+	unsigned bad = topic.empty();
+
+	for (char c : topic) {
+		bad |= unsigned(c == '+') | unsigned(c == '#');
+	}
+	return bad == 0;
+}
+
+bool mqtt::SplitSharedFilter(std::string_view filter, std::string_view* group, std::string_view* topic) {
+	constexpr std::string_view prefix = "$share/";
+
+	if (filter.substr(0, prefix.size()) != prefix) {
+		return false;
+	}
+
+	std::string_view rest = filter.substr(prefix.size());
+	size_t slash = rest.find('/');
+
+	*group = rest.substr(0, slash);
+	*topic = slash == std::string_view::npos ? std::string_view{} : rest.substr(slash + 1);
+	return true;
+}
+
+bool mqtt::ValidSharedFilter(std::string_view group, std::string_view topic) {
+	return !group.empty() && group.find_first_of("+#") == std::string_view::npos && ValidTopicFilter(topic);
+}
+
+shared_bytes mqtt::EncodePublish
+	(const uint8_t bits, const uint16_t pkt_id, std::string_view topic, std::string_view payload) {
+
+	size_t remaining_len = sizeof(uint16_t) + topic.size() + payload.size();
+
+	if (((bits & 0x6) >> 1u) > 0) {
+		remaining_len += sizeof(uint16_t);
+	}
+
+	uint8_t len_buf[MAX_LENGTH_BYTES];
+	int len_bytes = mqtt::EncodeLength(len_buf, remaining_len);
+
+	auto pkt = std::make_shared<std::vector<uint8_t>>();
+	pkt->reserve(1 + len_bytes + remaining_len);
+
+	pkt->push_back(bits);
+	pkt->insert(pkt->end(), len_buf, len_buf + len_bytes);
+	pkt->push_back(uint8_t(topic.size() >> 8u)); // MSB
+	pkt->push_back(uint8_t(topic.size())); // LSB
+	pkt->insert(pkt->end(), begin(topic), end(topic));
+
+	if (((bits & 0x6) >> 1u) > 0) {
+		pkt->push_back(uint8_t(pkt_id >> 8u));
+		pkt->push_back(uint8_t(pkt_id));
+	}
+
+	pkt->insert(pkt->end(), begin(payload), end(payload));
+
+	return pkt;
+}
+
+size_t mqtt::PublishIdOffset(const uint8_t* packet) {
+	size_t pos = 1;
+
+	while (packet[pos] & 0x80) {
+		pos++;
+	}
+	pos++;
+
+	size_t topic_len = (size_t(packet[pos]) << 8u) | packet[pos + 1];
+
+	return pos + sizeof(uint16_t) + topic_len;
+}
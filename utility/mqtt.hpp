@@ -1,141 +1,201 @@
-#ifndef MQTT_UTILITY_MQTT_H_
-#define MQTT_UTILITY_MQTT_H_
-
-#include <algorithm>
-#include <cstdint>
-#include <iterator>
-#include <map>
-#include <memory>
-#include <string>
-#include <vector>
-#include <variant>
-#include <list>
-
-#define CONNACK_BYTE  0x20
-#define PUBLISH_BYTE  0x30
-#define PUBACK_BYTE   0x40
-#define PUBREC_BYTE   0x50
-#define PUBREL_BYTE   0x62
-#define PUBCOMP_BYTE  0x70
-#define SUBACK_BYTE   0x90
-#define UNSUBACK_BYTE 0xB0
-#define PINGRESP_BYTE 0xD0
-
-typedef std::unique_ptr<uint8_t> uint8_ptr;
-
-enum kControlPacketType {
-	CONNECT = 1,
-	CONNACT,
-	PUBLISH,
-	PUBACK,
-	PUBREC,
-	PUBREL,
-	PUBCOMP,
-	SUBSCRIBE,
-	SUBACK,
-	UNSUBSCRIBE,
-	UNSUBACK,
-	PINGREQ,
-	PINGRESP,
-	DISCONNECT
-};
-
-namespace mqtt {
-	struct Header {
-		uint8_t bits;
-		uint8_t remaining_length;
-	};
-
-	struct Connect {
-		Header header;
-
-		struct {
-			uint8_t connect_flags;
-			uint16_t keepalive;
-			uint8_t level;
-		} variable_header;
-
-		struct {
-			std::string cliend_id;
-			std::string username;
-			std::string password;
-			std::string will_topic;
-			std::string will_message;
-		} payload;
-	};
-
-	struct Connack {
-		Header header;
-		uint8_t flags;
-		uint8_t rc;
-	};
-
-	struct Publish {
-		Header header;
-		std::string topic;
-		uint16_t pkt_id;
-		std::string payload;
-	};
-
-	struct Subscribe {
-		Header header;
-		uint16_t pkt_id;
-		std::multimap<std::string, uint8_t> topic_and_qos;
-	};
-
-	struct Unsubscribe {
-		Header header;
-		uint16_t pkt_id;
-		std::vector<std::string> topics;
-	};
-
-	struct Suback {
-		Header header;
-		uint16_t pkt_id;
-		std::vector<uint8_t> rcs;
-	};
-
-	struct AckPacket {
-		Header header;
-		uint16_t pkt_id;
-	};
-
-	typedef struct AckPacket Puback;
-	typedef struct AckPacket Pubrec;
-	typedef struct AckPacket Pubrel;
-	typedef struct AckPacket Pubcomp;
-	typedef struct AckPacket Unsuback;
-	typedef struct Header Pingreq;
-	typedef struct Header Pingresp;
-	typedef struct Header Disconnect;
-
-	typedef std::variant<AckPacket, Header, Connect, Connack, Suback, Publish, Subscribe, Unsubscribe, Disconnect> packet;
-
-	int EncodeLength(uint8_t *buffer, size_t len);
-	long long DecodeLength(const uint8_t *buffer);
-
-	//from buffer to packet object
-	size_t UnpackConnect(const uint8_t *buffer, Header *head, Connect *pkt);
-	size_t UnpackPublish(const uint8_t* buffer, Header* head, Publish* pkt);
-	long long UnpackSubscribe(const uint8_t* buffer, Header* head, Subscribe* pkt);
-	size_t UnpackUnsubscribe(const uint8_t* buffer, Header* head, Unsubscribe* pkt);
-	size_t UnpackAck(const uint8_t* buffer, Header* head, AckPacket* pkt);
-
-	//create a package from function parameters
-	AckPacket PacketAck(const uint8_t byte, const uint16_t pkt_id);
-	Connack PacketConnack(const uint8_t byte, const uint8_t flags, const uint8_t rc);
-	Suback PacketSuback(const uint8_t byte, const uint16_t pkt_id, const uint16_t rc_len, const uint8_t* rcs);
-	Publish PacketPublish(const uint8_t byte, const uint16_t pkt_id, const std::string topic, const std::string payload);
-
-	//fill buffer with packet
-	uint8_ptr PackHeader(Header* hdr);
-	uint8_ptr PackAck(AckPacket* ack);
-	uint8_ptr PackConnack(Connack* con);
-	uint8_ptr PackSuback(Suback* sub);
-	uint8_ptr PackPublish(Publish* pub);
-	uint8_ptr PackPingreq(Pingreq* ping);
-	uint8_ptr PackPingresp(Pingresp* ping);
-
-}	// namespace mqtt
-
+#ifndef MQTT_UTILITY_MQTT_H_
+#define MQTT_UTILITY_MQTT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <variant>
+#include <list>
+#include <string_view>
+
+#define CONNACK_BYTE  0x20
+#define PUBLISH_BYTE  0x30
+#define PUBACK_BYTE   0x40
+#define PUBREC_BYTE   0x50
+#define PUBREL_BYTE   0x62
+#define PUBCOMP_BYTE  0x70
+#define SUBACK_BYTE   0x90
+#define UNSUBACK_BYTE 0xB0
+#define PINGRESP_BYTE 0xD0
+
+#define MAX_LENGTH_BYTES  4
+#define LENGTH_INCOMPLETE -1
+#define LENGTH_MALFORMED  -2
+
+typedef std::unique_ptr<uint8_t> uint8_ptr;
+typedef std::shared_ptr<const std::vector<uint8_t>> shared_bytes;
+
+enum kControlPacketType {
+	CONNECT = 1,
+	CONNACT,
+	PUBLISH,
+	PUBACK,
+	PUBREC,
+	PUBREL,
+	PUBCOMP,
+	SUBSCRIBE,
+	SUBACK,
+	UNSUBSCRIBE,
+	UNSUBACK,
+	PINGREQ,
+	PINGRESP,
+	DISCONNECT
+};
+
+namespace mqtt {
+
+	// Result of the Unpack functions, every failure means the client broke the protocol
+	enum kDecodeStatus {
+		kDecoded = 0,  // the packet is valid
+		kTruncated,    // a field runs past the end of the frame
+		kBadLength,    // the Remaining Length is malformed or does not fit the fields of the packet
+		kBadFlags,     // reserved bits of the fixed header or of the connect flags are set wrong
+		kBadProtocol,  // CONNECT with an unknown protocol name
+		kBadQos,       // QoS 3 in PUBLISH or in a requested QoS of SUBSCRIBE
+		kNoTopics,     // SUBSCRIBE or UNSUBSCRIBE without a topic
+		kBadTopic      // PUBLISH or will to an empty topic name or one with '+' or '#'
+	};
+
+	struct Header {
+		uint8_t bits;
+		uint32_t remaining_length;
+	};
+
+	struct Connect {
+		Header header;
+
+		struct {
+			uint8_t connect_flags;
+			uint16_t keepalive;
+			uint8_t level;
+		} variable_header;
+
+		struct {
+			std::string cliend_id;
+			std::string username;
+			std::string password;
+			std::string will_topic;
+			std::string will_message;
+		} payload;
+	};
+
+	struct Connack {
+		Header header;
+		uint8_t flags;
+		uint8_t rc;
+	};
+
+	struct Publish {
+		Header header;
+		std::string topic;
+		uint16_t pkt_id;
+		std::string payload;
+	};
+
+	// PUBLISH parsed in place, topic and payload point into the frame and are valid while it is
+	struct PublishView {
+		Header header;
+		std::string_view topic;
+		uint16_t pkt_id = 0;
+		std::string_view payload;
+	};
+
+	struct Subscribe {
+		Header header;
+		uint16_t pkt_id;
+		std::vector<std::pair<std::string, uint8_t>> topic_and_qos; // in the order of the packet, as SUBACK needs
+	};
+
+	struct Unsubscribe {
+		Header header;
+		uint16_t pkt_id;
+		std::vector<std::string> topics;
+	};
+
+	struct Suback {
+		Header header;
+		uint16_t pkt_id;
+		std::vector<uint8_t> rcs;
+	};
+
+	struct AckPacket {
+		Header header;
+		uint16_t pkt_id;
+	};
+
+	typedef struct AckPacket Puback;
+	typedef struct AckPacket Pubrec;
+	typedef struct AckPacket Pubrel;
+	typedef struct AckPacket Pubcomp;
+	typedef struct AckPacket Unsuback;
+	typedef struct Header Pingreq;
+	typedef struct Header Pingresp;
+	typedef struct Header Disconnect;
+
+	typedef std::variant<AckPacket, Header, Connect, Connack, Suback, Publish, Subscribe, Unsubscribe, Disconnect> packet;
+
+	int EncodeLength(uint8_t *buffer, size_t len);
+
+	//decode at most MAX_LENGTH_BYTES bytes, returns LENGTH_MALFORMED if the length does not end there
+	long long DecodeLength(const uint8_t *buffer);
+
+	//decode at most size bytes, returns LENGTH_INCOMPLETE or LENGTH_MALFORMED on failure
+	long long DecodeLength(const uint8_t *buffer, size_t size, size_t *len_bytes);
+
+	const char* DecodeStatusString(kDecodeStatus status);
+
+	/*
+	*  From a frame to a packet object. size is the number of bytes available at frame,
+	*  every field is checked against the end of the frame and nothing outside of it is read.
+	*  The reserved flags and the Remaining Length of the fixed header are checked for every type
+	*/
+	kDecodeStatus UnpackHeader(const uint8_t* frame, size_t size, Header* head);
+	kDecodeStatus UnpackConnect(const uint8_t* frame, size_t size, Connect* pkt);
+	kDecodeStatus UnpackPublish(const uint8_t* frame, size_t size, Publish* pkt);
+
+	//nothing is copied, the topic and the payload point into the frame
+	kDecodeStatus UnpackPublish(const uint8_t* frame, size_t size, PublishView* pkt);
+	kDecodeStatus UnpackSubscribe(const uint8_t* frame, size_t size, Subscribe* pkt);
+	kDecodeStatus UnpackUnsubscribe(const uint8_t* frame, size_t size, Unsubscribe* pkt);
+	kDecodeStatus UnpackAck(const uint8_t* frame, size_t size, AckPacket* pkt);
+
+	//create a package from function parameters
+	AckPacket PacketAck(const uint8_t byte, const uint16_t pkt_id);
+	Connack PacketConnack(const uint8_t byte, const uint8_t flags, const uint8_t rc);
+	Suback PacketSuback(const uint8_t byte, const uint16_t pkt_id, const uint16_t rc_len, const uint8_t* rcs);
+	Publish PacketPublish(const uint8_t byte, const uint16_t pkt_id, const std::string topic, const std::string payload);
+
+	//fill buffer with packet
+	uint8_ptr PackHeader(Header* hdr);
+	uint8_ptr PackAck(AckPacket* ack);
+	uint8_ptr PackConnack(Connack* con);
+	uint8_ptr PackSuback(Suback* sub);
+	uint8_ptr PackPublish(Publish* pub);
+	uint8_ptr PackPingreq(Pingreq* ping);
+	uint8_ptr PackPingresp(Pingresp* ping);
+
+	//'#' must be the last level and '+' must take a whole level
+	bool ValidTopicFilter(std::string_view filter);
+
+	//topic names of PUBLISH are not empty and have no wildcards
+	bool ValidTopicName(std::string_view topic);
+
+	//"$share/{group}/{filter}" is split into the group and the filter, false for a filter that is not shared
+	bool SplitSharedFilter(std::string_view filter, std::string_view* group, std::string_view* topic);
+
+	//the group is not empty and has no wildcards, the filter is valid
+	bool ValidSharedFilter(std::string_view group, std::string_view topic);
+
+	//encode PUBLISH into an immutable buffer that can be shared by many subscribers
+	shared_bytes EncodePublish(const uint8_t bits, const uint16_t pkt_id, std::string_view topic, std::string_view payload);
+
+	//offset of the packet id in an encoded QoS 1 or 2 PUBLISH
+	size_t PublishIdOffset(const uint8_t* packet);
+
+}	// namespace mqtt
+
 #endif
\ No newline at end of file
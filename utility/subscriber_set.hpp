@@ -0,0 +1,178 @@
+#ifndef MQTT_CONTAINERS_SUBSCRIBER_SET_H_
+#define MQTT_CONTAINERS_SUBSCRIBER_SET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tree {
+
+    // One subscription of a topic filter, the handle names the session of a shard
+    struct subscriber {
+        uint32_t handle;
+        uint8_t qos;
+    };
+
+    /*
+    *  Subscribers of one topic filter in a contiguous array, at most one entry per handle.
+    *  Erase moves the last entry into the hole, so fan-out walks a dense array and
+    *  insert and erase are O(1). A small set finds a handle by scanning it, a set bigger
+    *  than index_from keeps a back-index from handles to positions in an open addressing table
+    */
+    class subscriber_set {
+    public:
+        static constexpr size_t index_from = 16;
+        static constexpr size_t npos = size_t(-1);
+
+        using const_iterator = std::vector<subscriber>::const_iterator;
+
+        // false if the handle is already there, its QoS is replaced. A new entry is the last one
+        bool insert(uint32_t handle, uint8_t qos) {
+            if (size_t pos = index_of(handle); pos != npos) {
+                entries_[pos].qos = qos;
+                return false;
+            }
+
+            entries_.push_back(subscriber{ handle, qos });
+
+            if (!slots_.empty() && entries_.size() * 2 > slots_.size()) {
+                rehash(slots_.size() * 2);
+            }
+            else if (slots_.empty() && entries_.size() > index_from) {
+                rehash(index_from * 4);
+            }
+            else if (!slots_.empty()) {
+                put(entries_.size() - 1);
+            }
+            return true;
+        }
+
+        // false if there is no such handle
+        bool erase(uint32_t handle) {
+            return erase_at(index_of(handle));
+        }
+
+        // hint is where the handle was seen, it is searched for only if another erase has moved it
+        bool erase(uint32_t handle, size_t hint) {
+            return erase_at(hint < entries_.size() && entries_[hint].handle == handle ? hint : index_of(handle));
+        }
+
+        const subscriber* find(uint32_t handle) const {
+            size_t pos = index_of(handle);
+            return pos == npos ? nullptr : &entries_[pos];
+        }
+
+        // position of the handle, npos if it is not there
+        size_t index_of(uint32_t handle) const {
+            if (slots_.empty()) {
+                for (size_t i = 0; i < entries_.size(); i++) {
+                    if (entries_[i].handle == handle) {
+                        return i;
+                    }
+                }
+                return npos;
+            }
+
+            size_t mask = slots_.size() - 1;
+
+            for (size_t i = home_of(handle, mask); slots_[i] != 0; i = (i + 1) & mask) {
+                if (entries_[slots_[i] - 1].handle == handle) {
+                    return slots_[i] - 1;
+                }
+            }
+            return npos;
+        }
+
+        size_t size() const { return entries_.size(); }
+        bool empty() const { return entries_.empty(); }
+
+        const_iterator begin() const { return entries_.begin(); }
+        const_iterator end() const { return entries_.end(); }
+
+    private:
+        bool erase_at(size_t pos) {
+            if (pos == npos) {
+                return false;
+            }
+
+            uint32_t handle = entries_[pos].handle;
+            size_t last = entries_.size() - 1;
+
+            if (!slots_.empty()) {
+                remove_slot(handle);
+
+                if (pos != last) {
+                    slots_[slot_of(entries_[last].handle)] = uint32_t(pos + 1);
+                }
+            }
+
+            entries_[pos] = entries_[last];
+            entries_.pop_back();
+
+            if (entries_.empty()) {
+                slots_.clear();
+                slots_.shrink_to_fit();
+            }
+            return true;
+        }
+
+        static size_t home_of(uint32_t handle, size_t mask) {
+            return size_t((uint64_t(handle) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        }
+
+        // is slot k in the cyclic range (i, j]
+        static bool between(size_t i, size_t k, size_t j) {
+            return i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        }
+
+        // the slot that holds the handle, it must be in the table
+        size_t slot_of(uint32_t handle) const {
+            size_t mask = slots_.size() - 1;
+            size_t i = home_of(handle, mask);
+
+            while (entries_[slots_[i] - 1].handle != handle) {
+                i = (i + 1) & mask;
+            }
+            return i;
+        }
+
+        void put(size_t pos) {
+            size_t mask = slots_.size() - 1;
+            size_t i = home_of(entries_[pos].handle, mask);
+
+            while (slots_[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = uint32_t(pos + 1);
+        }
+
+        // backward shift deletion, the entries behind the hole move up to where a lookup finds them
+        void remove_slot(uint32_t handle) {
+            size_t mask = slots_.size() - 1;
+            size_t i = slot_of(handle);
+
+            for (size_t j = (i + 1) & mask; slots_[j] != 0; j = (j + 1) & mask) {
+                size_t home = home_of(entries_[slots_[j] - 1].handle, mask);
+
+                if (!between(i, home, j)) {
+                    slots_[i] = slots_[j];
+                    i = j;
+                }
+            }
+            slots_[i] = 0;
+        }
+
+        void rehash(size_t capacity) {
+            slots_.assign(capacity, 0);
+
+            for (size_t pos = 0; pos < entries_.size(); pos++) {
+                put(pos);
+            }
+        }
+
+        std::vector<subscriber> entries_;
+        std::vector<uint32_t> slots_; // position + 1 of an entry, 0 for a free slot
+    };
+}
+
+#endif // !MQTT_CONTAINERS_SUBSCRIBER_SET_H_
@@ -1,149 +1,282 @@
-#ifndef MQTT_CONTAINERS_TRIE_H_
-#define MQTT_CONTAINERS_TRIE_H_
-
-#include <initializer_list>
-#include <iomanip>
-#include <iterator>
-#include <string>
-#include <memory>
-#include <fstream>
-#include <ranges>
-#include <map>
-
-namespace tree {
-
-    static std::vector<std::string> split(std::string_view path) {
-        std::vector<std::string> path_copy;
-
-        std::string_view::iterator it1 = begin(path);
-        std::string_view::iterator it2 = std::find(it1, end(path), '/');
-
-        while (it2 != end(path)) {
-            path_copy.push_back(std::string{ it1, it2 });
-            it1 = it2 + 1;
-            it2 = std::find(it1, end(path), '/');
-        }
-
-        path_copy.push_back(std::string{ it1, it2 });
-
-        return path_copy;
-    }
-
-    template<class T>
-    struct Node;
-
-    template<class T>
-    class trie {
-
-    public:
-        trie() {
-            node_ = std::make_unique<Node<T>>();
-        }
-
-        //Functions for removing an element from a tree
-        template<class It>
-        void insert(It it, It end_it, const T& data) { //Copy an element in the tree
-            if (it == end_it) {
-                node_->data_ = data;
-                return;
-            }
-
-            node_->children_[*it].insert(next(it), end_it, data); //descending deeper into the tree
-        }
-
-        template<class It>
-        void insert(It it, It end_it, const T&& data) { //Move an element in the tree
-            if (it == end_it) {
-                node_->data_ = std::move(data);
-                return;
-            }
-
-            node_->children_[*it].insert(it + 1, end_it, std::move(data)); //descending deeper into the tree
-            
-        }
-
-        void insert(std::string path, const T& data) {
-
-            std::vector<std::string> path_copy = split(path);
-
-            insert(begin(path_copy), end(path_copy), data);
-        }
-
-        //get element at specified path
-        template<class It>
-        T& get(It it, It end_it) {
-            if (it == end_it) {
-                return node_->data_;
-            }
-            return node_->children_[*it].get(next(it), end_it); //descending deeper into the tree
-        }
-
-        T& get(const std::string& path) {
-
-            std::vector<std::string> path_copy = split(path);
-
-            return get(begin(path_copy), end(path_copy));
-        }
-
-        //remove elemetn from tree
-        template<class It>
-        void remove(It it, It end_it) {
-            if (it + 1 == end_it) {
-                node_->children_[*it].node_->children_.clear();
-                node_->children_.erase(*it);
-                return;
-            }
-
-            return node_->children_[*it].remove(next(it), end_it); //descending deeper into the tree
-        }
-
-        void remove(std::string path) {
-
-            std::vector<std::string> path_copy = split(path);
-
-            return remove(begin(path_copy), end(path_copy));
-        }
-
-        void print(std::ostream& os) {
-            if (!node_) {
-                return;
-            }
-
-            for (auto& [path, node] : node_->children_) {
-                os << path << ' ' << node.node_->data_ << '\n';
-                node.print(os);
-
-            }
-        }
-
-        std::map<std::string, trie<T>>* get_node(const std::string &path) {
-            
-            std::vector<std::string> path_copy = split(path);
-
-            tree::trie<T> *tr = this;
-
-            for(const auto& piece_of_top : path_copy) {
-                tr = &tr->node_->children_[piece_of_top];
-            }
-
-            return &tr->node_->children_;
-
-        }
-
-
-        bool empty() {
-            return node_;
-        }
-    private:
-        std::unique_ptr<Node<T>> node_;
-    };
-
-    template<class T>
-    struct Node {
-        std::map<std::string, trie<T>> children_;
-        T data_;
-    };
-}
-
-#endif // !MQTT_CONTAINERS_TRIE_H_
-
+#ifndef MQTT_CONTAINERS_TRIE_H_
+#define MQTT_CONTAINERS_TRIE_H_
+
+#include <initializer_list>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <ranges>
+#include <map>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+namespace tree {
+
+    // Levels of a topic as views into the topic itself, nothing is copied
+    class levels {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const std::string_view*;
+            using reference = std::string_view;
+
+            iterator() = default;
+
+            iterator(std::string_view path, size_t pos) : path_(path), pos_(pos) {
+                find_end();
+            }
+
+            std::string_view operator*() const {
+                return path_.substr(pos_, end_ - pos_);
+            }
+
+            iterator& operator++() {
+                if (end_ == path_.size()) {
+                    pos_ = std::string_view::npos;
+                    return *this;
+                }
+
+                pos_ = end_ + 1;
+                find_end();
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator it = *this;
+                ++(*this);
+                return it;
+            }
+
+            bool operator==(const iterator& other) const {
+                return pos_ == other.pos_;
+            }
+
+        private:
+            void find_end() {
+                if (pos_ == std::string_view::npos) {
+                    return;
+                }
+
+                end_ = path_.find('/', pos_);
+                if (end_ == std::string_view::npos) {
+                    end_ = path_.size();
+                }
+            }
+
+            std::string_view path_;
+            size_t pos_ = std::string_view::npos;
+            size_t end_ = 0;
+        };
+
+        explicit levels(std::string_view path) : path_(path) {}
+
+        iterator begin() const { return iterator{ path_, 0 }; }
+        iterator end() const { return iterator{ path_, std::string_view::npos }; }
+
+    private:
+        std::string_view path_;
+    };
+
+    template<class T>
+    struct Node;
+
+    template<class T>
+    class trie {
+
+    public:
+        trie() {
+            node_ = std::make_unique<Node<T>>();
+        }
+
+        //Functions for removing an element from a tree
+        template<class It>
+        void insert(It it, It end_it, const T& data) { //Copy an element in the tree
+            if (it == end_it) {
+                node_->data_ = data;
+                return;
+            }
+
+            child(*it).insert(std::next(it), end_it, data); //descending deeper into the tree
+        }
+
+        template<class It>
+        void insert(It it, It end_it, T&& data) { //Move an element in the tree
+            if (it == end_it) {
+                node_->data_ = std::move(data);
+                return;
+            }
+
+            child(*it).insert(std::next(it), end_it, std::move(data)); //descending deeper into the tree
+
+        }
+
+        void insert(std::string_view path, const T& data) {
+
+            levels path_levels{ path };
+
+            insert(path_levels.begin(), path_levels.end(), data);
+        }
+
+        //get element at specified path, missing nodes are created
+        template<class It>
+        T& get(It it, It end_it) {
+            if (it == end_it) {
+                return node_->data_;
+            }
+            return child(*it).get(std::next(it), end_it); //descending deeper into the tree
+        }
+
+        T& get(std::string_view path) {
+
+            levels path_levels{ path };
+
+            return get(path_levels.begin(), path_levels.end());
+        }
+
+        //find element at specified path without creating nodes, nullptr if there is no such path
+        T* find(std::string_view path) {
+
+            trie<T>* tr = this;
+
+            for (std::string_view level : levels{ path }) {
+                tr = tr->find_child(level);
+
+                if (tr == nullptr) {
+                    return nullptr;
+                }
+            }
+
+            return &tr->node_->data_;
+        }
+
+        //remove elemetn from tree
+        template<class It>
+        void remove(It it, It end_it) {
+            auto child_it = node_->children_.find(*it);
+
+            if (child_it == node_->children_.end()) {
+                return;
+            }
+
+            if (std::next(it) == end_it) {
+                node_->children_.erase(child_it);
+                return;
+            }
+
+            return child_it->second.remove(std::next(it), end_it); //descending deeper into the tree
+        }
+
+        void remove(std::string_view path) {
+
+            levels path_levels{ path };
+
+            return remove(path_levels.begin(), path_levels.end());
+        }
+
+        void print(std::ostream& os) {
+            if (!node_) {
+                return;
+            }
+
+            for (auto& [path, node] : node_->children_) {
+                os << path << ' ' << node.node_->data_ << '\n';
+                node.print(os);
+
+            }
+        }
+
+        std::map<std::string, trie<T>, std::less<>>* get_node(std::string_view path) {
+
+            tree::trie<T> *tr = this;
+
+            for(std::string_view piece_of_top : levels{ path }) {
+                tr = &tr->child(piece_of_top);
+            }
+
+            return &tr->node_->children_;
+
+        }
+
+        /*
+        *  Calls f(data) for every subscription that matches the topic name.
+        *  Exact, '+' and '#' branches are visited in a single pass over the topic,
+        *  wildcards on the first level do not match topics starting with '$'
+        */
+        template<class F>
+        void match(std::string_view topic, F&& f) {
+            match(topic, false, true, f);
+        }
+
+        bool empty() {
+            return node_;
+        }
+    private:
+        //child with the specified name, it is created if there is no such child
+        trie<T>& child(std::string_view level) {
+            auto it = node_->children_.find(level);
+
+            if (it == node_->children_.end()) {
+                it = node_->children_.emplace(std::string{ level }, trie<T>{}).first;
+            }
+            return it->second;
+        }
+
+        trie<T>* find_child(std::string_view level) {
+            auto it = node_->children_.find(level);
+
+            if (it == node_->children_.end()) {
+                return nullptr;
+            }
+            return &it->second;
+        }
+
+        template<class F>
+        void match(std::string_view rest, bool done, bool first, F& f) {
+
+            if (done) {
+                f(node_->data_);
+
+                // "a/#" also matches "a"
+                if (trie<T>* multi = find_child("#")) {
+                    f(multi->node_->data_);
+                }
+                return;
+            }
+
+            size_t pos = rest.find('/');
+            std::string_view level = rest.substr(0, pos);
+            std::string_view next = pos == std::string_view::npos ? std::string_view{} : rest.substr(pos + 1);
+            bool next_done = pos == std::string_view::npos;
+
+            if (!(first && !level.empty() && level[0] == '$')) {
+                if (trie<T>* multi = find_child("#")) {
+                    f(multi->node_->data_);
+                }
+
+                if (trie<T>* single = find_child("+")) {
+                    single->match(next, next_done, false, f);
+                }
+            }
+
+            if (trie<T>* exact = find_child(level)) {
+                exact->match(next, next_done, false, f);
+            }
+        }
+
+        std::unique_ptr<Node<T>> node_;
+    };
+
+    template<class T>
+    struct Node {
+        std::map<std::string, trie<T>, std::less<>> children_;
+        T data_;
+    };
+}
+
+#endif // !MQTT_CONTAINERS_TRIE_H_